@@ -24,9 +24,14 @@
 
 #include <algorithm> // don't need this for C++11
 #include <cmath>
+#include <cstdarg>
+#include <cstdio>
 #include <cstring>
+#include <deque>
 #include <errno.h>
+#include <limits>
 #include <map>
+#include <numeric>
 #include <set>
 #include <sstream>
 #include <string>
@@ -41,10 +46,35 @@
 #   include <stdlib.h>
 #   include <sys/stat.h>
 #   include <sys/types.h>
+#   include <unistd.h>
 #endif /* WINDOWS */
 
 #include <math.h>
 
+// Use the C++17 std::to_chars() floating point conversions when available
+#if defined(__has_include)
+#   if __has_include(<charconv>) && ((__cplusplus >= 201703L) || \
+            (defined(_MSVC_LANG) && (_MSVC_LANG >= 201703L)))
+#       include <charconv>
+#   endif
+#endif
+#if defined(__cpp_lib_to_chars)
+#   define HAVE_FLOAT_TO_CHARS
+#endif /* __cpp_lib_to_chars */
+
+// Output is compressed and written on worker threads when std::thread exists
+#if (__cplusplus >= 201103L) || \
+        (defined(_MSVC_LANG) && (_MSVC_LANG >= 201103L))
+#   include <thread>
+#   define HAVE_STD_THREAD
+#endif
+
+// Gzip compressed output requires zlib. Define HAVE_ZLIB and link with zlib
+// to enable it.
+#if defined(HAVE_ZLIB)
+#   include <zlib.h>
+#endif /* HAVE_ZLIB */
+
 // Disable warnings caused by the current usage of fgets, fscanf, etc.
 #if defined(linux)
 #pragma GCC diagnostic ignored "-Wunused-result"
@@ -54,6 +84,7 @@
 typedef std::set<std::string>               StringSet;
 typedef std::vector<std::string>            StringVec;
 typedef std::map<PWP_UINT32, PWP_UINT32>    UInt32UInt32Map;
+typedef std::map<PWP_UINT32, PWP_UINT64>    UInt32UInt64Map;
 typedef std::map<const char*, PWP_UINT32>   CharPtrUInt32Map;
 
 enum Orientation {
@@ -74,6 +105,31 @@ static const PWGM_CONDDATA UnspecifiedCond = {
 static const char *FaceExport       = "FaceExport";
 static const char *CellExport       = "CellExport";
 static const char *PointPrecision   = "PointPrecision";
+static const char *PointPrecisionMode = "PointPrecisionMode";
+static const char *FacesFormat      = "FacesFormat";
+static const char *LabelSize        = "LabelSize";
+static const char *WriteBufferSize  = "WriteBufferSize";
+static const char *Compression      = "Compression";
+static const char *FileHandler      = "FileHandler";
+static const char *NumberOfSubdomains = "NumberOfSubdomains";
+static const char *DecompositionMethod = "DecompositionMethod";
+static const char *CellOrder        = "CellOrder";
+static const char *PointOrder       = "PointOrder";
+static const char *PatchFaceOrder   = "PatchFaceOrder";
+static const char *FaceOrderCheck   = "FaceOrderCheck";
+enum FaceCheckMode {
+    FaceCheckOff,
+    FaceCheckReport,
+    FaceCheckRepair
+};
+static const char *QualityCheck     = "QualityCheck";
+enum QualityMode {
+    QualityOff,
+    QualityReport,
+    QualitySets
+};
+static const char *VertexCacheSize  = "VertexCacheSize";
+static const char *DecomposeMemorySize = "DecomposeMemorySize";
 static const char *Thickness        = "Thickness";
 static const char *SideBCExport     = "SideBCExport";
 enum SideBcMode {
@@ -87,6 +143,19 @@ static const PWP_REAL   ThicknessDef            = 0.0;
 static const char *     ThicknessDefStr         = "0.0";
 static const PWP_UINT   PointPrecisionDef       = 16;
 static const char *     PointPrecisionDefStr    = "16";
+// enough significant digits to round trip a single precision value
+static const PWP_UINT   PointPrecisionSingleMax = 9;
+static const PWP_UINT   PointPrecisionMin       = 4;
+static const PWP_UINT   PointPrecisionMax       = 16;
+// per-file output buffer size in KiB
+static const PWP_UINT   WriteBufferSizeDef      = 1024;
+static const char *     WriteBufferSizeDefStr   = "1024";
+// largest point coordinate cache in MiB
+static const PWP_UINT   VertexCacheSizeDef      = 1024;
+static const char *     VertexCacheSizeDefStr   = "1024";
+// largest in-memory mesh copy for decomposition in MiB, some 4*10^7 cells
+static const PWP_UINT   DecomposeMemorySizeDef  = 8192;
+static const char *     DecomposeMemorySizeDefStr = "8192";
 
 
 /***************************************************************************
@@ -114,6 +183,43 @@ pwpDeleteDir(const char *dir)
 }
 
 
+/***************************************************************************
+ * pwpGetCwd: get the current working directory with '/' separators
+ ***************************************************************************/
+static bool
+pwpGetCwd(std::string &dir)
+{
+    char buf[4096];
+#if defined(WINDOWS)
+    const bool ret = (0 != _getcwd(buf, sizeof(buf)));
+#else
+    const bool ret = (0 != getcwd(buf, sizeof(buf)));
+#endif /* WINDOWS */
+    if (ret) {
+        dir = buf;
+        std::replace(dir.begin(), dir.end(), '\\', '/');
+    }
+    return ret;
+}
+
+
+/***************************************************************************
+ * pwpFileWriteUnlocked: write to a file without taking the stdio lock. The
+ * caller must be the only thread using fp.
+ ***************************************************************************/
+static size_t
+pwpFileWriteUnlocked(const void *buf, size_t size, size_t count, FILE *fp)
+{
+#if defined(WINDOWS)
+    return _fwrite_nolock(buf, size, count, fp);
+#elif defined(__GLIBC__)
+    return fwrite_unlocked(buf, size, count, fp);
+#else
+    return pwpFileWrite(buf, size, count, fp);
+#endif /* WINDOWS */
+}
+
+
 // return a sanitized file name
 static const char *
 safeFileName(const char *unsafeName, const char *suffix = "")
@@ -181,6 +287,258 @@ calcLength(const PWGM_XYZVAL xyzStart[3], const PWGM_XYZVAL xyzEnd[3])
 }
 
 
+/***************************************************************************
+ * Class ParallelFor splits the items [0, count) into contiguous ranges and
+ * processes them concurrently when std::thread is available. The ranges
+ * only depend on count and grain, so results do not depend on the number of
+ * threads.
+ ***************************************************************************/
+class ParallelFor {
+public:
+    enum { MaxRanges = 64 }; // max num ranges
+
+    // get the number of ranges count items are split into. Each range has
+    // at least grain items.
+    static PWP_UINT32 numRanges(PWP_UINT64 count, PWP_UINT64 grain = 65536)
+    {
+        const PWP_UINT64 n = count / std::max(grain, (PWP_UINT64)1);
+        return (PWP_UINT32)std::min(std::max(n, (PWP_UINT64)1),
+            (PWP_UINT64)MaxRanges);
+    }
+
+    // get the first item of a range
+    static PWP_UINT64 rangeBegin(PWP_UINT64 count, PWP_UINT32 numRanges,
+        PWP_UINT32 range)
+    {
+        return (count * range) / numRanges;
+    }
+
+    // get the number of threads ranges are processed on
+    static PWP_UINT32 numThreads()
+    {
+#if defined(HAVE_STD_THREAD)
+        return std::max((PWP_UINT32)std::thread::hardware_concurrency(),
+            (PWP_UINT32)1);
+#else
+        return 1;
+#endif /* HAVE_STD_THREAD */
+    }
+
+    // call body(range, begin, end) for each range of count items. Ranges
+    // may be processed concurrently, body must only modify data owned by
+    // its range.
+    template<typename Body>
+    static void run(PWP_UINT64 count, Body &body, PWP_UINT64 grain = 65536)
+    {
+        const PWP_UINT32 n = numRanges(count, grain);
+#if defined(HAVE_STD_THREAD)
+        const PWP_UINT32 numThreads = std::min(n,
+            ParallelFor::numThreads());
+        if (1 < numThreads) {
+            // each thread takes every numThreads'th range, this thread
+            // takes the first
+            std::vector<std::thread> threads;
+            threads.reserve(numThreads - 1);
+            for (PWP_UINT32 ii = 1; ii < numThreads; ++ii) {
+                threads.push_back(std::thread(runRanges<Body>, &body, count,
+                    n, ii, numThreads));
+            }
+            runRanges<Body>(&body, count, n, 0, numThreads);
+            for (size_t ii = 0; ii < threads.size(); ++ii) {
+                threads[ii].join();
+            }
+            return;
+        }
+#endif /* HAVE_STD_THREAD */
+        runRanges<Body>(&body, count, n, 0, 1);
+    }
+
+private:
+    // call body for the ranges first, first + stride, ...
+    template<typename Body>
+    static void runRanges(Body *body, PWP_UINT64 count, PWP_UINT32 n,
+        PWP_UINT32 first, PWP_UINT32 stride)
+    {
+        for (PWP_UINT32 ii = first; ii < n; ii += stride) {
+            (*body)(ii, rangeBegin(count, n, ii), rangeBegin(count, n, ii + 1));
+        }
+    }
+};
+
+
+/***************************************************************************
+ * Class VertexCache holds the x, y and z of every model vertex in separate
+ * arrays, so each vertex is fetched through the plugin API only once. The
+ * vertices are read directly when the cache is not loaded.
+ ***************************************************************************/
+class VertexCache {
+public:
+    // Default constructor
+    VertexCache() :
+        x_(),
+        y_(),
+        z_()
+    {
+    }
+
+    // destructor
+    ~VertexCache()
+    {
+    }
+
+    // fetch every vertex of model, return false if one could not be read
+    bool load(PWGM_HGRIDMODEL model)
+    {
+        const PWP_UINT32 numVerts = PwModVertexCount(model);
+        x_.resize(numVerts);
+        y_.resize(numVerts);
+        z_.resize(numVerts);
+        PWGM_VERTDATA v;
+        for (PWP_UINT32 ii = 0; ii < numVerts; ++ii) {
+            if (!PwVertDataMod(PwModEnumVertices(model, ii), &v)) {
+                release();
+                return false;
+            }
+            x_[ii] = v.x;
+            y_[ii] = v.y;
+            z_[ii] = v.z;
+        }
+        return true;
+    }
+
+    // free the arrays
+    void release()
+    {
+        std::vector<PWGM_XYZVAL>().swap(x_);
+        std::vector<PWGM_XYZVAL>().swap(y_);
+        std::vector<PWGM_XYZVAL>().swap(z_);
+    }
+
+    // return true if the vertices are held
+    bool isLoaded() const
+    {
+        return !x_.empty();
+    }
+
+    // get the number of vertices held
+    PWP_UINT32 size() const
+    {
+        return (PWP_UINT32)x_.size();
+    }
+
+    // get the memory held by the arrays in bytes
+    size_t bytes() const
+    {
+        return bytesFor((PWP_UINT32)x_.size());
+    }
+
+    // get the memory needed to hold numVerts vertices in bytes
+    static size_t bytesFor(PWP_UINT32 numVerts)
+    {
+        return 3 * sizeof(PWGM_XYZVAL) * (size_t)numVerts;
+    }
+
+    // get the vertex coordinate arrays
+    const std::vector<PWGM_XYZVAL> & x() const { return x_; }
+    const std::vector<PWGM_XYZVAL> & y() const { return y_; }
+    const std::vector<PWGM_XYZVAL> & z() const { return z_; }
+
+    // get vertex ii
+    void getVertex(PWP_UINT32 ii, PWGM_VERTDATA &v) const
+    {
+        v.x = x_[ii];
+        v.y = y_[ii];
+        v.z = z_[ii];
+        v.i = ii;
+    }
+
+    // get the coordinates of vertex ii of elem
+    bool getXYZ(PWGM_XYZVAL xyz[3], const PWGM_ELEMDATA &elem,
+        PWP_UINT32 ii) const
+    {
+        if (x_.empty()) {
+            return ::getXYZ(xyz, elem.vert[ii]);
+        }
+        const PWP_UINT32 ndx = elem.index[ii];
+        xyz[0] = x_[ndx];
+        xyz[1] = y_[ndx];
+        xyz[2] = z_[ndx];
+        return true;
+    }
+
+    // get the min and max z of the vertices, reduced concurrently
+    void zRange(PWGM_XYZVAL &minZ, PWGM_XYZVAL &maxZ) const
+    {
+        ZRangeBody body(z_);
+        ParallelFor::run(z_.size(), body);
+        minZ = *std::min_element(body.min_.begin(), body.min_.end());
+        maxZ = *std::max_element(body.max_.begin(), body.max_.end());
+    }
+
+    // get the largest coordinate magnitude of the vertices
+    PWGM_XYZVAL maxAbs() const
+    {
+        PWGM_XYZVAL ret = 0.0;
+        for (size_t ii = 0; ii < x_.size(); ++ii) {
+            ret = std::max(ret, (PWGM_XYZVAL)fabs(x_[ii]));
+            ret = std::max(ret, (PWGM_XYZVAL)fabs(y_[ii]));
+            ret = std::max(ret, (PWGM_XYZVAL)fabs(z_[ii]));
+        }
+        return ret;
+    }
+
+private:
+    // ParallelFor body finding the min and max z of each range
+    struct ZRangeBody {
+        enum { Lanes = 32 }; // independent min and max lanes
+
+        ZRangeBody(const std::vector<PWGM_XYZVAL> &z) :
+            z_(z),
+            min_(ParallelFor::numRanges(z.size()),
+                std::numeric_limits<PWGM_XYZVAL>::max()),
+            max_(min_.size(), -std::numeric_limits<PWGM_XYZVAL>::max())
+        {
+        }
+
+        // Reduce the range in Lanes independent lanes. A single running
+        // min and max is a serial dependency the compiler will not vectorize
+        // without fast math, the lanes map to vector registers instead.
+        void operator()(PWP_UINT32 range, PWP_UINT64 begin, PWP_UINT64 end)
+        {
+            PWGM_XYZVAL lo[Lanes];
+            PWGM_XYZVAL hi[Lanes];
+            for (int ll = 0; ll < Lanes; ++ll) {
+                lo[ll] = min_[range];
+                hi[ll] = max_[range];
+            }
+            const PWGM_XYZVAL *z = &z_[0];
+            PWP_UINT64 ii = begin;
+            for (; ii + Lanes <= end; ii += Lanes) {
+                for (int ll = 0; ll < Lanes; ++ll) {
+                    const PWGM_XYZVAL v = z[ii + ll];
+                    lo[ll] = (v < lo[ll]) ? v : lo[ll];
+                    hi[ll] = (hi[ll] < v) ? v : hi[ll];
+                }
+            }
+            for (; ii < end; ++ii) {
+                lo[0] = std::min(lo[0], z[ii]);
+                hi[0] = std::max(hi[0], z[ii]);
+            }
+            min_[range] = *std::min_element(lo, lo + Lanes);
+            max_[range] = *std::max_element(hi, hi + Lanes);
+        }
+
+        const std::vector<PWGM_XYZVAL> &z_;
+        std::vector<PWGM_XYZVAL>        min_;
+        std::vector<PWGM_XYZVAL>        max_;
+    };
+
+    std::vector<PWGM_XYZVAL>    x_; // vertex x
+    std::vector<PWGM_XYZVAL>    y_; // vertex y
+    std::vector<PWGM_XYZVAL>    z_; // vertex z
+};
+
+
 /*
 
 From: http://www.openfoam.org/docs/user/mesh-description.php
@@ -222,6 +580,13 @@ points of the face need to be coplanar.
 class GridValidator {
 public:
 
+    // the first element of a block not oriented like the grid
+    struct Conflict {
+        PWP_UINT32  block_;     // block index
+        PWP_UINT32  element_;   // element index in the block
+    };
+    typedef std::vector<Conflict> Conflicts;
+
     /****************************************************************************
      * 
      * The getGridProperties(CAEP_RTITEM) function, used locally.
@@ -232,19 +597,21 @@ public:
      * the points for the triangles and quads as well as to decide the direction the z 
      * component will be incremented. If any domain is not oriented the same way as 
      * the first domain, a warning message is displayed to the user and the orientation
-     * is assumed to be the direction of the first domain.
+     * is assumed to be the direction of the first domain. The first element
+     * of each domain not oriented that way is added to conflicts. The vertex
+     * coordinates are read from verts.
      * 
      ***************************************************************************/
     static void
-    getGridProperties(PWGM_HGRIDMODEL model, bool &isZPlanar,
-        PWGM_XYZVAL &planeZ, Orientation &orientation, bool &consistent)
+    getGridProperties(PWGM_HGRIDMODEL model, const VertexCache &verts,
+        bool &isZPlanar, PWGM_XYZVAL &planeZ, Orientation &orientation,
+        bool &consistent, Conflicts &conflicts)
     {
         PWGM_XYZVAL xyz0[3];
         PWGM_XYZVAL xyz1[3];
         PWGM_XYZVAL xyz2[3];
         PWGM_XYZVAL vector1[3];
         PWGM_XYZVAL vector2[3];
-        PWGM_HVERTEX vertex;
         PWGM_HELEMENT element;
         PWGM_HBLOCK block;
         PWGM_ELEMDATA data = {PWGM_ELEMTYPE_SIZE};
@@ -255,29 +622,25 @@ public:
         element = PwBlkEnumElements(block, 0);
         PwElemDataMod(element, &data);
 
-        vertex = PwModEnumVertices(model, data.index[0]);
-        getXYZ(xyz0, vertex);
-        vertex = PwModEnumVertices(model, data.index[1]);
-        getXYZ(xyz1, vertex);
+        verts.getXYZ(xyz0, data, 0);
+        verts.getXYZ(xyz1, data, 1);
 
         if (data.vertCnt == 4) {
             // Element is a quad, the vertex to be used is the vertex right
             // next to the 0th point i.e. point 3.
-            vertex = PwModEnumVertices(model, data.index[3]);
-            getXYZ(xyz2, vertex);
+            verts.getXYZ(xyz2, data, 3);
         } 
         else if (data.vertCnt == 3) {
             // Element is a tri, the vertex to be used is the only other vertex
             // remaining.
-            vertex = PwModEnumVertices(model, data.index[2]);
-            getXYZ(xyz2, vertex);
+            verts.getXYZ(xyz2, data, 2);
         }
     
         createVector(vector1, xyz0, xyz1);
         createVector(vector2, xyz0, xyz2);
         orientation = calcZOrientation(vector1, vector2);
-        isConsistent(model, orientation, consistent);
-        isPlanar(model, isZPlanar, planeZ);
+        isConsistent(model, verts, orientation, consistent, conflicts);
+        isPlanar(model, verts, isZPlanar, planeZ);
     }
 
 
@@ -300,783 +663,4507 @@ private:
 
 
     /**************************************************************************
-    * This function verifies if the domains of each block is oriented the same
-    * way. This is done by performing a vector cross product inside of each
-    * block and comparing that with the orientation of the first block.
+    * This function verifies that every element of every block is oriented the
+    * same way as the first element of the first block. The elements are
+    * read one at a time, as the plugin API has no bulk element access, and
+    * checked in chunks using the vertex x and y from verts. A block is only
+    * checked up to its first element with the other orientation, which is
+    * added to conflicts.
     **************************************************************************/
     static void
-    isConsistent(PWGM_HGRIDMODEL model, const Orientation masterOrientation,
-        bool &consistent)
+    isConsistent(PWGM_HGRIDMODEL model, const VertexCache &verts,
+        const Orientation masterOrientation, bool &consistent,
+        Conflicts &conflicts)
     {
-        PWP_UINT32 i;
-        PWGM_XYZVAL xyz0[3], xyz1[3], xyz2[3];
-        PWGM_XYZVAL vector1[3], vector2[3];
-        PWP_UINT32 numBlocks = PwModBlockCount(model);
-        PWGM_HVERTEX vertex;
-        PWGM_HELEMENT element;
-        PWGM_ELEMDATA data = {PWGM_ELEMTYPE_SIZE};
-        PWGM_HBLOCK block;
-
         consistent = true;
-        for (i=1; i < numBlocks; i++) {
-            block = PwModEnumBlocks(model, i);
-            element = PwBlkEnumElements(block, 0);
-            PwElemDataMod(element, &data);
-
-            vertex = PwModEnumVertices(model, data.index[0]);
-            getXYZ(xyz0, vertex);
-            vertex = PwModEnumVertices(model, data.index[1]);
-            getXYZ(xyz1, vertex);
-
-            if (data.vertCnt == 4) {
-                vertex = PwModEnumVertices(model, data.index[3]);
-                getXYZ(xyz2, vertex);
-            }
-            else if (data.vertCnt == 3) {
-                vertex = PwModEnumVertices(model, data.index[2]);
-                getXYZ(xyz2, vertex);
-            }
-            createVector(vector1, xyz0, xyz1);
-            createVector(vector2, xyz0, xyz2);
-            // Check to see if this block is oriented the same way as the first
-            // block.
-            if (masterOrientation != calcZOrientation(vector1, vector2)) {
-                consistent = false;
-                break;
+        conflicts.clear();
+        OrientationChunk chunk(masterOrientation);
+        PWGM_ELEMDATA data = {PWGM_ELEMTYPE_SIZE};
+        PWP_UINT32 numBlocks = PwModBlockCount(model);
+        for (PWP_UINT32 i = 0; i < numBlocks; i++) {
+            PWGM_HBLOCK block = PwModEnumBlocks(model, i);
+            const PWP_UINT32 numElems = PwBlkElementCount(block, 0);
+            for (PWP_UINT32 first = 0; first < numElems;
+                    first += OrientationChunk::ChunkSize) {
+                const PWP_UINT32 n = std::min(numElems - first,
+                    (PWP_UINT32)OrientationChunk::ChunkSize);
+                for (PWP_UINT32 ii = 0; ii < n; ++ii) {
+                    PwElemDataMod(PwBlkEnumElements(block, first + ii), &data);
+                    chunk.setElement(ii, data, verts);
+                }
+                const PWP_UINT32 conflict = chunk.firstConflict(n);
+                if (conflict < n) {
+                    const Conflict c = { i, first + conflict };
+                    conflicts.push_back(c);
+                    consistent = false;
+                    break;
+                }
             }
         }
     }
+
+
+    /**************************************************************************
+    * OrientationChunk finds the first element of a chunk of tris and quads
+    * that is not oriented like the grid. The orientation is the sign of the
+    * element's area, summed over its edges. A tri repeats its last vertex.
+    * Elements without area have no orientation. The areas are computed in
+    * a branch free loop over arrays of the element vertices, then scanned.
+    **************************************************************************/
+    struct OrientationChunk {
+        enum { ChunkSize = 64 * 1024 }; // num elements checked together
+
+        OrientationChunk(Orientation masterOrientation) :
+            sign_((PositiveZ == masterOrientation) ? 1.0 : -1.0),
+            area_(ChunkSize)
+        {
+            for (int ii = 0; ii < 4; ++ii) {
+                x_[ii].resize(ChunkSize);
+                y_[ii].resize(ChunkSize);
+            }
+        }
+
+        // set chunk element ii, reading its vertices from verts
+        void setElement(PWP_UINT32 ii, const PWGM_ELEMDATA &data,
+            const VertexCache &verts)
+        {
+            const PWP_UINT32 cnt = std::max(std::min(data.vertCnt,
+                (PWP_UINT32)4), (PWP_UINT32)1);
+            PWGM_XYZVAL xyz[3] = { 0.0, 0.0, 0.0 };
+            for (PWP_UINT32 jj = 0; jj < 4; ++jj) {
+                if (jj < cnt) {
+                    verts.getXYZ(xyz, data, jj);
+                }
+                x_[jj][ii] = xyz[0];
+                y_[jj][ii] = xyz[1];
+            }
+        }
+
+        // get the first of the chunk's n elements not oriented like the
+        // grid, or n if none
+        PWP_UINT32 firstConflict(PWP_UINT32 n)
+        {
+            orientedAreas(n);
+            PWP_UINT32 k = 0;
+            while ((k < n) && (0.0 <= area_[k])) {
+                ++k;
+            }
+            return k;
+        }
+
+        // get the area of the chunk's first n elements, negative if not
+        // oriented like the grid
+        void orientedAreas(PWP_UINT32 n)
+        {
+            const PWGM_XYZVAL *x0 = &x_[0][0];
+            const PWGM_XYZVAL *x1 = &x_[1][0];
+            const PWGM_XYZVAL *x2 = &x_[2][0];
+            const PWGM_XYZVAL *x3 = &x_[3][0];
+            const PWGM_XYZVAL *y0 = &y_[0][0];
+            const PWGM_XYZVAL *y1 = &y_[1][0];
+            const PWGM_XYZVAL *y2 = &y_[2][0];
+            const PWGM_XYZVAL *y3 = &y_[3][0];
+            PWGM_XYZVAL *area = &area_[0];
+            const PWGM_XYZVAL sign = sign_;
+            for (PWP_UINT32 k = 0; k < n; ++k) {
+                area[k] = sign * ((x0[k] * y1[k] - x1[k] * y0[k]) +
+                    (x1[k] * y2[k] - x2[k] * y1[k]) +
+                    (x2[k] * y3[k] - x3[k] * y2[k]) +
+                    (x3[k] * y0[k] - x0[k] * y3[k]));
+            }
+        }
+
+        PWGM_XYZVAL                     sign_;      // 1 if +z, -1 if -z
+        std::vector<PWGM_XYZVAL>        x_[4];      // chunk element vert x
+        std::vector<PWGM_XYZVAL>        y_[4];      // chunk element vert y
+        std::vector<PWGM_XYZVAL>        area_;      // chunk oriented areas
+    };
     
 
     /**************************************************************************
     * This function verifies if a grid is planar in the xy-plane. This is done
-    * by checking the value of the first point with all other points and
-    * comparing that value with the value of the grid tolerance.
+    * by comparing the z of the first point with the min and max z of all the
+    * points, within the grid tolerance. The points are read from verts if it
+    * is loaded, else from the model.
     **************************************************************************/
     static void
-    isPlanar(PWGM_HGRIDMODEL model, bool &isZPlanar, PWGM_XYZVAL &planeZ)
+    isPlanar(PWGM_HGRIDMODEL model, const VertexCache &verts, bool &isZPlanar,
+        PWGM_XYZVAL &planeZ)
     {
         PWP_REAL gridPtTol;
         PwModGetAttributeREAL(model, "GridPointTol", &gridPtTol);
-        PWP_UINT32 index = 0;
-        PWGM_VERTDATA masterPt;
-        if (!PwVertDataMod(PwModEnumVertices(model, index), &masterPt)) {
+        PWGM_XYZVAL minZ;
+        PWGM_XYZVAL maxZ;
+        if (verts.isLoaded()) {
+            planeZ = verts.z()[0];
+            verts.zRange(minZ, maxZ);
+        }
+        else if (!zRange(model, planeZ, minZ, maxZ)) {
             // someting very bad just happened
             isZPlanar = false;
             planeZ = 0.0;
+            return;
         }
-        else {
-            PWGM_VERTDATA vData;
-            planeZ = masterPt.z;
-            isZPlanar = true;
-            while (PwVertDataMod(PwModEnumVertices(model, ++index), &vData)) {
-                const PWGM_XYZVAL dz = planeZ - vData.z;
-                if (fabs(dz) > gridPtTol) {
-                    isZPlanar = false;
-                    break;
-                }
-            }
+        isZPlanar = (fabs(planeZ - minZ) <= gridPtTol) &&
+            (fabs(planeZ - maxZ) <= gridPtTol);
+    }
+
+
+    // Read the z of the first point and the min and max z of all the points
+    // from the model. Returns false if there are no points.
+    static bool
+    zRange(PWGM_HGRIDMODEL model, PWGM_XYZVAL &firstZ, PWGM_XYZVAL &minZ,
+        PWGM_XYZVAL &maxZ)
+    {
+        PWP_UINT32 index = 0;
+        PWGM_VERTDATA vData;
+        if (!PwVertDataMod(PwModEnumVertices(model, index), &vData)) {
+            return false;
         }
+        firstZ = minZ = maxZ = vData.z;
+        while (PwVertDataMod(PwModEnumVertices(model, ++index), &vData)) {
+            minZ = std::min(minZ, vData.z);
+            maxZ = std::max(maxZ, vData.z);
+        }
+        return true;
     }
 };
 
 
 /***************************************************************************
- * Base class FoamFile represents any output file for OpenFOAM.
+ * Class LabelFormatter converts unsigned integers to decimal text two digits
+ * at a time using a lookup table.
  ***************************************************************************/
-class FoamFile {
+class LabelFormatter {
+public:
+    enum { BufSize = 20 }; // max num chars written for one value
 
-    enum { FldWd = 10 }; // num chars reserved for the numItems
+    // format v into buf, return a pointer past the last char written
+    static char * format(char *buf, PWP_UINT64 v)
+    {
+        static const char DigitPairs[] =
+            "00010203040506070809"
+            "10111213141516171819"
+            "20212223242526272829"
+            "30313233343536373839"
+            "40414243444546474849"
+            "50515253545556575859"
+            "60616263646566676869"
+            "70717273747576777879"
+            "80818283848586878889"
+            "90919293949596979899";
+        // build the digits right to left
+        char tmp[BufSize];
+        char *p = tmp + BufSize;
+        while (v >= 100) {
+            const char *pair = DigitPairs + 2 * (v % 100);
+            v /= 100;
+            *--p = pair[1];
+            *--p = pair[0];
+        }
+        if (v >= 10) {
+            const char *pair = DigitPairs + 2 * v;
+            *--p = pair[1];
+            *--p = pair[0];
+        }
+        else {
+            *--p = (char)('0' + v);
+        }
+        const size_t len = (size_t)(tmp + BufSize - p);
+        memcpy(buf, p, len);
+        return buf + len;
+    }
 
-public:
-    // Constructor
-    FoamFile(const char *cls, const char *object, const char *location = 0,
-        const char *version = 0, const char *format = 0) :
-            class_(cls ? cls : ""),
-            object_(object ? object : ""),
-            location_(location ? location : "constant/polyMesh"),
-            version_(version ? version : "2.0"),
-            format_(format ? format : "ascii"),
-            fp_(0),
-            pos_(),
-            numItems_(0)
+    // Format v preceded by a space into buf. Rows are ended with a newline
+    // after rowSize values. The rowCnt tracks the num values in the row.
+    static char * formatRowItem(char *buf, PWP_UINT64 v, PWP_UINT32 &rowCnt,
+        PWP_UINT32 rowSize)
     {
+        *buf++ = ' ';
+        buf = format(buf, v);
+        if (rowSize == ++rowCnt) {
+            *buf++ = '\n';
+            rowCnt = 0;
+        }
+        return buf;
     }
+};
 
-    // Destructor
-    virtual ~FoamFile()
+
+/***************************************************************************
+ * Class FoamFormat describes how the list data of an OpenFOAM file is
+ * encoded. The file header is always ascii.
+ ***************************************************************************/
+class FoamFormat {
+public:
+    // Default constructor, ascii encoding with 32-bit labels and 64-bit
+    // scalars
+    FoamFormat(bool binary = false, PWP_UINT32 labelSize = 32,
+            PWP_UINT32 scalarSize = 64) :
+        binary_(binary),
+        labelSize_(64 == labelSize ? 64 : 32),
+        scalarSize_(32 == scalarSize ? 32 : 64)
     {
-        // ensure file closure
-        close();
     }
 
-    // set the class of file, stored in internal file header
-    void setClass(const char *cls)
+    // get the value of the header "format" entry
+    const char * name() const
     {
-        class_ = (cls ? cls : "");
+        return binary_ ? "binary" : "ascii";
     }
 
-    // get the class of file
-    const char * getClass() const
+    // get the value of the header "arch" entry
+    std::string arch() const
     {
-        return class_.c_str();
+        const PWP_UINT32 one = 1;
+        const bool isLSB = (1 == *(const unsigned char *)&one);
+        std::ostringstream oss;
+        oss << (isLSB ? "LSB" : "MSB") << ";label=" << labelSize_
+            << ";scalar=" << scalarSize_;
+        return oss.str();
     }
 
-    // open the output file and write file header
-    bool open(const char *object = 0)
+    // get the size of a binary label in bytes
+    size_t labelBytes() const
     {
-        close();
-        numItems_ = 0;
-        if (0 != object) {
-            object_ = object;
-        }
-        if (!object_.empty()) {
-            fp_ = pwpFileOpen(object_.c_str(), pwpWrite | pwpAscii);
-        }
-        if (fp_) {
-            this->notifyOpen();
-            writeFileHeader();
-            pwpFileGetpos(fp_, &pos_);
-            fprintf(fp_, "%*d\n", -FldWd, 0);
-            fprintf(fp_, "(\n");
-        }
-        return 0 != fp_;
+        return (64 == labelSize_) ? sizeof(PWP_INT64) : sizeof(PWP_INT32);
     }
 
-    // close the file
-    void close()
+    // get the largest label value OpenFOAM can read
+    PWP_UINT64 maxLabel() const
     {
-        if (0 != fp_) {
-            sysFILEPOS savePos;
-            if (getSetFilePos(savePos, pos_)) {
-                fprintf(fp_, "%*lu\n", -FldWd, (unsigned long)numItems_);
-                pwpFileSetpos(fp_, &savePos);
-            }
-            this->notifyClosing();
-            fputs(")\n", fp_);
-            pwpFileClose(fp_);
-            fp_ = 0;
-        }
+        return (64 == labelSize_) ? 0x7FFFFFFFFFFFFFFFULL : 0x7FFFFFFFULL;
     }
 
-    // increment the item counter
-    PWP_UINT32 incrNumItems(PWP_UINT32 incr = 1)
+    // get the num chars reserved for a list's item count
+    int countWidth() const
     {
-        return (numItems_ += incr);
+        return (64 == labelSize_) ? 20 : 10;
     }
 
-    // get the current number of items
-    PWP_UINT32 getNumItems() const
+    // Encode count labels as raw binary into buf. Return the number of
+    // bytes used. The buf must hold count 64-bit values.
+    size_t encodeLabels(const PWP_UINT64 labels[], size_t count,
+        PWP_INT64 buf[]) const
     {
-        return numItems_;
+        if (64 == labelSize_) {
+            for (size_t ii = 0; ii < count; ++ii) {
+                buf[ii] = (PWP_INT64)labels[ii];
+            }
+        }
+        else {
+            PWP_INT32 *lbls = (PWP_INT32 *)buf;
+            for (size_t ii = 0; ii < count; ++ii) {
+                lbls[ii] = (PWP_INT32)labels[ii];
+            }
+        }
+        return count * labelBytes();
     }
 
-    // return whether the file is open
-    bool isOpen() const
+    // Decode count raw binary labels from buf.
+    void decodeLabels(const void *buf, size_t count, PWP_UINT64 labels[]) const
     {
-        return 0 != fp_;
+        if (64 == labelSize_) {
+            const PWP_INT64 *lbls = (const PWP_INT64 *)buf;
+            for (size_t ii = 0; ii < count; ++ii) {
+                labels[ii] = (PWP_UINT64)lbls[ii];
+            }
+        }
+        else {
+            const PWP_INT32 *lbls = (const PWP_INT32 *)buf;
+            for (size_t ii = 0; ii < count; ++ii) {
+                labels[ii] = (PWP_UINT64)lbls[ii];
+            }
+        }
     }
 
-    // return the object (file) name
-    const char *object() const
+    bool        binary_;    // true if list data is written as raw binary
+    PWP_UINT32  labelSize_; // label size in bits, 32 or 64
+    PWP_UINT32  scalarSize_;// scalar size in bits, 32 or 64
+};
+
+
+#if defined(HAVE_ZLIB)
+/***************************************************************************
+ * Class GzipBlockWriter compresses blocks of data into independent gzip
+ * members and writes them to a file in order. A file of concatenated
+ * members is a valid gzip file. Queued blocks are compressed concurrently.
+ ***************************************************************************/
+class GzipBlockWriter {
+
+    enum { MaxThreads = 8 }; // max num blocks compressed at once
+
+    struct Block {
+        std::vector<char>           in_;    // uncompressed data
+        size_t                      inLen_; // num bytes used in in_
+        std::vector<unsigned char>  out_;   // gzip member
+        bool                        ok_;    // true if out_ is valid
+    };
+
+public:
+    // Constructor, the caller owns fp
+    GzipBlockWriter(FILE *fp, int level = Z_DEFAULT_COMPRESSION) :
+        fp_(fp),
+        level_(level),
+        blocks_(numThreads()),
+        numQueued_(0),
+        ok_(true)
     {
-        return object_.c_str();
     }
 
-    // provide access to the underlying FILE pointer
-    operator FILE*()
+    // Destructor
+    ~GzipBlockWriter()
     {
-        return fp_;
+        finish();
     }
 
-private:
-    // change file position to setPos, store old position in getPos
-    bool getSetFilePos(sysFILEPOS &getPos, const sysFILEPOS &setPos)
+    // queue the first len bytes of data as a block. The data is swapped
+    // with an unused buffer of the same size to avoid a copy.
+    bool write(std::vector<char> &data, size_t len)
     {
-        return fp_ && !pwpFileGetpos(fp_, &getPos) &&
-                !pwpFileSetpos(fp_, &setPos);
+        if (0 == len) {
+            return ok_;
+        }
+        Block &blk = blocks_[numQueued_++];
+        const size_t size = data.size();
+        blk.in_.swap(data);
+        blk.inLen_ = len;
+        data.resize(size);
+        if (blocks_.size() == numQueued_) {
+            writeQueued();
+        }
+        return ok_;
     }
 
-    // callback for subclasses after the output file is opened successfully
-    virtual void notifyOpen()
+    // compress and write all queued blocks
+    bool finish()
     {
-        // do nothing by default
+        writeQueued();
+        return ok_;
     }
 
-    // callback for subclasses that the output file is about to be closed
-    virtual void notifyClosing()
+private:
+    // num blocks compressed at once
+    static size_t numThreads()
     {
-        // do nothing by default
+#if defined(HAVE_STD_THREAD)
+        const size_t n = std::thread::hardware_concurrency();
+        return std::min(std::max(n, (size_t)1), (size_t)MaxThreads);
+#else
+        return 1;
+#endif /* HAVE_STD_THREAD */
     }
 
-    // write standard file header for all OpenFOAM files
-    void writeFileHeader()
+    // compress a block into a complete gzip member
+    static void compress(Block *blk, int level)
     {
-        fprintf(fp_,     "FoamFile\n");
-        fprintf(fp_,     "{\n");
-        fprintf(fp_,     "    version     %s;\n", version_.c_str());
-        fprintf(fp_,     "    format      %s;\n", format_.c_str());
-        fprintf(fp_,     "    class       %s;\n", class_.c_str());
-        fprintf(fp_,     "    location    \"%s\";\n", location_.c_str());
-        fprintf(fp_,     "    object      %s;\n", object_.c_str());
-        fputs("}\n", fp_);
-        fputs("\n", fp_);
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        // 15 window bits plus 16 selects the gzip wrapper
+        blk->ok_ = (Z_OK == deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8,
+            Z_DEFAULT_STRATEGY));
+        if (blk->ok_) {
+            blk->out_.resize(deflateBound(&zs, (uLong)blk->inLen_));
+            zs.next_in = (Bytef*)&blk->in_[0];
+            zs.avail_in = (uInt)blk->inLen_;
+            zs.next_out = &blk->out_[0];
+            zs.avail_out = (uInt)blk->out_.size();
+            blk->ok_ = (Z_STREAM_END == deflate(&zs, Z_FINISH));
+            blk->out_.resize(zs.total_out);
+            deflateEnd(&zs);
+        }
     }
 
-private:
-    std::string   class_;       // output file class name
-    std::string   object_;      // output file name
-    std::string   location_;    // ouput file location
-    std::string   version_;     // output file version
-    std::string   format_;      // output file format
-    FILE        * fp_;          // underlying FILE
-    sysFILEPOS    pos_;         // file position of item counter
-    PWP_UINT32    numItems_;    // number of items written to the file
+    // compress the queued blocks and write them in order
+    void writeQueued()
+    {
+        if (0 == numQueued_) {
+            return;
+        }
+#if defined(HAVE_STD_THREAD)
+        // this thread compresses the first block
+        std::vector<std::thread> threads;
+        threads.reserve(numQueued_ - 1);
+        for (size_t ii = 1; ii < numQueued_; ++ii) {
+            threads.push_back(std::thread(compress, &blocks_[ii], level_));
+        }
+        compress(&blocks_[0], level_);
+        for (size_t ii = 0; ii < threads.size(); ++ii) {
+            threads[ii].join();
+        }
+#else
+        for (size_t ii = 0; ii < numQueued_; ++ii) {
+            compress(&blocks_[ii], level_);
+        }
+#endif /* HAVE_STD_THREAD */
+        for (size_t ii = 0; ii < numQueued_; ++ii) {
+            const Block &blk = blocks_[ii];
+            ok_ = ok_ && blk.ok_ && (blk.out_.size() == pwpFileWriteUnlocked(
+                &blk.out_[0], 1, blk.out_.size(), fp_));
+        }
+        numQueued_ = 0;
+    }
+
+private:
+    FILE *              fp_;        // output file
+    int                 level_;     // zlib compression level
+    std::vector<Block>  blocks_;    // compression queue
+    size_t              numQueued_; // num blocks used in blocks_
+    bool                ok_;        // false after any failure
 };
+#endif /* HAVE_ZLIB */
 
 
 /***************************************************************************
- * Class FoamPointFile writes an OpenFOAM "points" file. The points file
- * contains all mesh global vertices.
+ * Base class FoamFile represents any output file for OpenFOAM.
  ***************************************************************************/
-class FoamPointFile : public FoamFile {
+class FoamFile {
+
+    enum { PrintSize = 1024 }; // initial print() buffer reservation
+
 public:
-    // Default constructor, set class name and file name
-    FoamPointFile(PWP_UINT prec) :
-        FoamFile("vectorField", "points"),
-        prec_(prec)
+    enum { MinBufSize = 64 * 1024 }; // min output buffer size in bytes
+
+    static const PWP_UINT64 UnknownCount; // open() count is not known
+
+    // Set the OpenFOAM "processors" directory used by files opened after this
+    // call. If not empty, each file is written as a collated
+    // decomposedBlockData container at root/location/object. An empty root
+    // restores the uncollated layout.
+    static void setCollatedRoot(const std::string &root)
     {
+        collatedRoot_ = root;
     }
 
-    // destructor
-    virtual ~FoamPointFile()
+    // Set the processor block written by collated files opened after this
+    // call. Block 0 creates the container, later blocks are appended to it.
+    static void setCollatedBlock(PWP_UINT32 block)
     {
+        collatedBlock_ = block;
     }
 
-
-    // write vertex to points file, one per line
-    // (x y z)
-    inline void
-    writeVertex(const PWGM_VERTDATA &v)
+    // return whether files are written as collated containers
+    static bool isCollated()
     {
-        const int p = (int)prec_;
-        fprintf(*this, "(%.*g %.*g %.*g)\n", p, v.x, p, v.y, p, v.z);
-        incrNumItems();
+        return !collatedRoot_.empty();
     }
 
-
-    // write global vertex to points file
-    inline void
-    writeVertex(const PWGM_HVERTEX h)
+    // get the path of the file written for location/object
+    static std::string filePath(const std::string &location,
+        const std::string &object)
     {
-        PWGM_VERTDATA v;
-        if (PwVertDataMod(h, &v)) {
-            writeVertex(v);
-        }
+        return isCollated() ? (collatedRoot_ + "/" + location + "/" + object) :
+            object;
     }
 
-
-    // write global vertex to points file
-    void writeVertex(const PWGM_HVERTEX h, const PWGM_XYZVAL newZ)
+    // Constructor
+    FoamFile(const char *cls, const char *object,
+        const FoamFormat &fmt = FoamFormat(), const char *location = 0,
+        const char *version = 0) :
+            class_(cls ? cls : ""),
+            object_(object ? object : ""),
+            location_(location ? location : "constant/polyMesh"),
+            version_(version ? version : "2.0"),
+            fmt_(fmt),
+            fp_(0),
+            pos_(),
+            blockPos_(),
+            blockStart_(0),
+            bytesWritten_(0),
+            numItems_(0),
+            expectedCount_(UnknownCount),
+            maxLabel_(0),
+            buf_(),
+            bufLen_(0),
+            bufSize_(MinBufSize),
+            compress_(false),
+            gz_(0)
     {
-        PWGM_VERTDATA v;
-        if (PwVertDataMod(h, &v)) {
-            v.z = newZ;
-            writeVertex(v);
-        }
     }
 
+    // Destructor
+    virtual ~FoamFile()
+    {
+        // ensure file closure
+        close();
+    }
 
-private:
-
-    PWP_UINT    prec_;
-};
+    // Set the output buffer size used when this file is next opened. Files
+    // use MinBufSize unless set.
+    void setBufferSize(size_t size)
+    {
+        bufSize_ = std::max(size, (size_t)MinBufSize);
+    }
 
+    // get the output buffer size used when opening this file
+    size_t getBufferSize() const
+    {
+        return bufSize_;
+    }
 
-/***************************************************************************
- * Class FoamFacesFile write an OpenFOAM "faces" file. The faces file
- * contains cell face information as a list of global vertex indices.
- * A face is written as the number of vertices followed by the list of
- * vertices that comprise the face (quad, tri or bar).
- ***************************************************************************/
-class FoamFacesFile : public FoamFile {
-public:
-    // Default constructor, set class and file name
-    FoamFacesFile(bool is2D, PWP_UINT32 vertexCount) :
-        FoamFile("faceList", "faces"),
-        is2D_(is2D),
-        vertexCount_(vertexCount)
+    // set whether this file is gzip compressed when it is next opened with a
+    // known item count. Ignored unless built with zlib.
+    void setCompression(bool compress)
     {
+        compress_ = compress;
     }
 
-    // destructor
-    virtual ~FoamFacesFile()
+    // set the class of file, stored in internal file header
+    void setClass(const char *cls)
     {
+        class_ = (cls ? cls : "");
     }
 
-    // write a cell face to the faces file
-    void writeFace(PWGM_ELEMDATA &eData)
+    // get the class of file
+    const char * getClass() const
     {
-        // The PW cell-face owner/bndry model has the face normals pointing
-        // to the interior of the owner cell. Due to the way cells are
-        // processed during streaming, the owner cell will always have a lower
-        // cell id. The OpenFOAM spec requires an internal face normal to point
-        // from the lower numbered cell to the higher numbered cell. Boundary
-        // face normals must point outside the volume. Basically, the
-        // exact opposite of PW.
+        return class_.c_str();
+    }
 
-        // Use a switch to avoid multiple fprintf() calls in a loop
-        switch (eData.type) {
-        case PWGM_ELEMTYPE_QUAD:
-            fprintf(*this, "%lu(%lu %lu %lu %lu)\n",
-                (unsigned long)eData.vertCnt, 
-                (unsigned long)eData.index[3],
-                (unsigned long)eData.index[2], 
-                (unsigned long)eData.index[1],
-                (unsigned long)eData.index[0]);
-            incrNumItems();
-            break;
-        case PWGM_ELEMTYPE_TRI:
-            fprintf(*this, "%lu(%lu %lu %lu)\n", 
-                (unsigned long)eData.vertCnt,
-                (unsigned long)eData.index[2], 
-                (unsigned long)eData.index[1],
-                (unsigned long)eData.index[0]);
-            incrNumItems();
-            break;
-        case PWGM_ELEMTYPE_BAR:
-            if (is2D_) {
-                fprintf(*this, "%lu(%lu %lu %lu %lu)\n",
-                    (unsigned long)eData.vertCnt + 2,
-                    (unsigned long)eData.index[0],
-                    (unsigned long)eData.index[1],
-                    (unsigned long)eData.index[1] + vertexCount_,
-                    (unsigned long)eData.index[0] + vertexCount_);
-                incrNumItems();
+    // open the output file and write file header. If count is known, it is
+    // written to the header as is and verified by close(). Otherwise, a
+    // placeholder is written and back-patched by close(), which requires a
+    // seekable file.
+    bool open(const char *object = 0, PWP_UINT64 count = UnknownCount)
+    {
+        close();
+        numItems_ = 0;
+        expectedCount_ = count;
+        maxLabel_ = 0;
+        if (0 != object) {
+            object_ = object;
+        }
+        // The header count cannot be patched in a compressed file. OpenFOAM
+        // does not read compressed collated files.
+        const bool compress = compress_ && !isCollated() &&
+            (UnknownCount != count);
+        if (object_.empty()) {
+            // no file name
+        }
+        else if (isCollated() && (0 == collatedBlock_)) {
+            fp_ = pwpFileOpen(filePath(location_, object_).c_str(),
+                pwpWrite | pwpBinary);
+        }
+        else if (isCollated()) {
+            // append a block, the file must stay seekable for back-patching
+            fp_ = pwpFileOpen(filePath(location_, object_).c_str(),
+                pwpRead | pwpWrite | pwpBinary);
+            if ((0 != fp_) && (0 != fseek(fp_, 0, SEEK_END))) {
+                pwpFileClose(fp_);
+                fp_ = 0;
+            }
+        }
+        else if (compress) {
+            // OpenFOAM reads the uncompressed file first if both exist
+            pwpFileDelete(object_.c_str());
+            fp_ = pwpFileOpen((object_ + ".gz").c_str(), pwpWrite | pwpBinary);
+        }
+        else {
+            fp_ = pwpFileOpen(object_.c_str(),
+                pwpWrite | (isBinary() ? pwpBinary : pwpAscii));
+        }
+        if (fp_ && !this->notifyOpen()) {
+            pwpFileClose(fp_);
+            fp_ = 0;
+        }
+        if (fp_) {
+#if defined(HAVE_ZLIB)
+            if (compress) {
+                gz_ = new GzipBlockWriter(fp_);
+            }
+#endif /* HAVE_ZLIB */
+            // all output is collected in buf_, stdio buffering is redundant
+            setvbuf(fp_, 0, _IONBF, 0);
+            buf_.resize(bufSize_);
+            bufLen_ = 0;
+            bytesWritten_ = 0;
+            if (isCollated()) {
+                writeBlockHeader();
+            }
+            writeFileHeader();
+            if (UnknownCount != expectedCount_) {
+                print("%*llu\n", -fmt_.countWidth(),
+                    (unsigned long long)expectedCount_);
             }
             else {
-                fprintf(*this, "%lu(%lu %lu)\n", 
-                    (unsigned long)eData.vertCnt,
-                    (unsigned long)eData.index[1], 
-                    (unsigned long)eData.index[0]);
-                incrNumItems();
+                getPos(pos_);
+                print("%*d\n", -fmt_.countWidth(), 0);
             }
-            break;
-        default:
-            break;
+            // binary list data must immediately follow the open paren
+            writeStr(isBinary() ? "(" : "(\n");
         }
+        return 0 != fp_;
     }
 
-private:
-    PWP_UINT32  vertexCount_;     // Total number of vertices in file
-    PWP_BOOL    is2D_;            // Is the file 2D?
-};
-
-
-/***************************************************************************
- * Base Class FoamAddressFile is used to write OpenFOAM cell topology
- * information.
- ***************************************************************************/
-class FoamAddressFile : public FoamFile {
-
-    enum { ItemsPerRow = 10 }; // max num addresses per line
+    // close the file, return false if the file could not be completed or
+    // the item count does not match the count passed to open()
+    bool close()
+    {
+        bool ret = true;
+        if (0 != fp_) {
+            // subclass may add trailing items
+            this->notifyClosing();
+            if (UnknownCount == expectedCount_) {
+                ret = patch(pos_, fmt_.countWidth(), numItems_);
+            }
+            writeStr(")\n");
+            this->notifyListClosed();
+            if (isCollated()) {
+                // the block size excludes its closing paren
+                const PWP_UINT64 blockSize = tell() - blockStart_;
+                writeStr(")\n");
+                ret = patch(blockPos_, BlockSizeWidth, blockSize) && ret;
+            }
+            ret = flush() && ret;
+#if defined(HAVE_ZLIB)
+            if (0 != gz_) {
+                ret = gz_->finish() && ret;
+                delete gz_;
+                gz_ = 0;
+            }
+#endif /* HAVE_ZLIB */
+            pwpFileClose(fp_);
+            fp_ = 0;
+            // many set files stay open at once, only open files hold a buffer
+            std::vector<char>().swap(buf_);
+            ret = ret && !countMismatch();
+        }
+        return ret;
+    }
 
-public:
-    // Constructor, set class type as "labelList"
-    FoamAddressFile(const char *object, const char *location = 0) :
-        FoamFile("labelList", object, location)
+    // increment the item counter
+    PWP_UINT64 incrNumItems(PWP_UINT64 incr = 1)
     {
+        return (numItems_ += incr);
     }
 
-    // Destructor, forces end-of-line for partially filled rows
-    virtual ~FoamAddressFile()
+    // get the current number of items
+    PWP_UINT64 getNumItems() const
     {
-        cleanup();
+        return numItems_;
     }
 
-    // write an address to the current row in the file, adding a row as needed
-    void writeAddress(PWP_UINT32 addr)
+    // get the item count passed to open()
+    PWP_UINT64 getExpectedCount() const
     {
-        const char *fmt = (needNewline() ? " %lu\n" : " %lu");
-        fprintf(*this, fmt, (unsigned long)addr);
-        incrNumItems();
+        return expectedCount_;
     }
 
-private:
-    // break rows at ItemsPerRow items
-    bool needNewline() const {
-        return ((getNumItems() % ItemsPerRow) == (ItemsPerRow - 1));
+    // return whether the items written differ from the count passed to open()
+    bool countMismatch() const
+    {
+        return (UnknownCount != expectedCount_) &&
+            (numItems_ != expectedCount_);
     }
 
-    // close partial row
-    void cleanup()
+    // track the largest label written to the file
+    void checkLabel(PWP_UINT64 label)
     {
-        if (isOpen()) {
-            if (0 != getNumItems() % ItemsPerRow) {
-                fputs("\n", *this);
-            }
+        if (label > maxLabel_) {
+            maxLabel_ = label;
         }
     }
 
-    // inherited callback to force end-of-row cleanup
-    virtual void notifyClosing()
+    // return whether a label or the item count exceeds the label size
+    bool labelOverflow() const
     {
-        cleanup();
+        return (maxLabel_ > fmt_.maxLabel()) || (numItems_ > fmt_.maxLabel());
     }
-};
-
 
-/***************************************************************************
- * Class FoamOwnerFile writes an OpenFOAM "owner" file. This file
- * maps face index to owner cell index.
- ***************************************************************************/
-class FoamOwnerFile : public FoamAddressFile {
-public:
-    // Default constructor, sets object to "owner"
-    FoamOwnerFile() :
-        FoamAddressFile("owner")
+    // get the file format
+    const FoamFormat & format() const
     {
+        return fmt_;
     }
 
-    // destructor
-    virtual ~FoamOwnerFile()
+    // return whether the file is open
+    bool isOpen() const
     {
+        return 0 != fp_;
     }
-};
-
 
-/***************************************************************************
- * Class FoamNeighbourFile writes an OpenFOAM "neighbour" file. This file
- * maps face index to the neighbour cell index, if any. (Boundary faces do
- * not have neighbour cells.)
- ***************************************************************************/
-class FoamNeighbourFile : public FoamAddressFile {
-public:
-    // Default constructor, sets object to "neighbour"
-    FoamNeighbourFile() :
-        FoamAddressFile("neighbour")
+    // return whether the list data is written as raw binary
+    bool isBinary() const
     {
+        return fmt_.binary_;
     }
 
-    // destructor
-    virtual ~FoamNeighbourFile()
+    // return the object (file) name
+    const char *object() const
     {
+        return object_.c_str();
     }
-};
 
-
-/***************************************************************************
- * Base class FoamSetFile writes an OpenFOAM "sets" file. A sets file
- * is a list of object (cell or face) indices.
- ***************************************************************************/
-class FoamSetFile : public FoamAddressFile {
-public:
-    // Constructor, sets location to "sets" directory
-    FoamSetFile(const char *cls) :
-        FoamAddressFile("", "constant/polyMesh/sets")
+    // get a pointer to at least size free bytes in the output buffer
+    char * reserve(size_t size)
     {
-        setClass(cls);
+        if (bufLen_ + size > buf_.size()) {
+            flush();
+        }
+        return &buf_[0] + bufLen_;
     }
 
-    // destructor
-    virtual ~FoamSetFile()
+    // mark the output buffer as used up to end
+    void commit(const char *end)
     {
+        bufLen_ = (size_t)(end - &buf_[0]);
     }
-};
-
 
-/***************************************************************************
- * Class FoamCellSetFile writes an OpenFOAM "cellSet" file. A cellSet file
- * contains a list of cell indices for a given set.
- ***************************************************************************/
-class FoamCellSetFile : public FoamSetFile {
-public:
-    // Default constructor sets class to "cellSet"
-    FoamCellSetFile() :
-        FoamSetFile("cellSet")
+    // write the output buffer contents to the file
+    bool flush()
     {
+        bool ret = true;
+        bytesWritten_ += bufLen_;
+        if (0 == bufLen_) {
+            // nothing to write
+        }
+#if defined(HAVE_ZLIB)
+        else if (0 != gz_) {
+            // buf_ is swapped with an unused buffer
+            ret = gz_->write(buf_, bufLen_);
+        }
+#endif /* HAVE_ZLIB */
+        else {
+            ret = (bufLen_ == pwpFileWriteUnlocked(&buf_[0], 1, bufLen_,
+                fp_));
+        }
+        bufLen_ = 0;
+        return ret;
     }
 
-    // destructor
-    virtual ~FoamCellSetFile()
+    // write raw data through the output buffer
+    bool write(const void *buf, size_t size, size_t count)
     {
+        const size_t len = size * count;
+        if (len <= buf_.size() / 2) {
+            // buffer it below
+        }
+        else if (0 == gz_) {
+            // too big to buffer
+            bytesWritten_ += len;
+            return flush() &&
+                (count == pwpFileWriteUnlocked(buf, size, count, fp_));
+        }
+        else {
+            // queue it in buffer sized blocks
+            const char *p = (const char *)buf;
+            const size_t half = buf_.size() / 2;
+            bool ret = true;
+            for (size_t ii = 0; ret && (ii < len); ii += half) {
+                ret = write(p + ii, 1, std::min(half, len - ii));
+            }
+            return ret;
+        }
+        char *p = reserve(len);
+        memcpy(p, buf, len);
+        commit(p + len);
+        return true;
     }
-};
 
+    // write a string through the output buffer
+    bool writeStr(const char *str)
+    {
+        return write(str, 1, strlen(str));
+    }
 
-/***************************************************************************
- * Class FoamFaceSetFile writes an OpenFOAM "faceSet" file. A faceSet file
- * contains a list of face indices for a given set.
- ***************************************************************************/
-class FoamFaceSetFile : public FoamSetFile {
-public:
-    // Default constructor, sets class to "faceSet"
-    FoamFaceSetFile() :
-        FoamSetFile("faceSet")
+    // write printf formatted text through the output buffer
+    bool print(const char *fmt, ...)
     {
+        va_list args;
+        va_start(args, fmt);
+        size_t avail = std::max(buf_.size() - bufLen_, (size_t)PrintSize);
+        char *p = reserve(avail);
+        avail = buf_.size() - bufLen_;
+        int len = vsnprintf(p, avail, fmt, args);
+        va_end(args);
+        if ((0 <= len) && ((size_t)len >= avail)) {
+            // did not fit, format the text on its own
+            std::vector<char> tmp(len + 1);
+            va_start(args, fmt);
+            len = vsnprintf(&tmp[0], tmp.size(), fmt, args);
+            va_end(args);
+            return (0 <= len) && write(&tmp[0], 1, len);
+        }
+        if (0 <= len) {
+            commit(p + len);
+        }
+        return 0 <= len;
     }
 
-    // destructor
-    virtual ~FoamFaceSetFile()
+    // write a raw binary label
+    bool writeLabel(PWP_UINT64 label)
     {
+        return writeLabels(&label, 1);
     }
-};
 
-typedef std::map<const char*, FoamCellSetFile*> VcNameToFile;
-typedef std::map<FoamCellSetFile*, PWP_UINT32>  FileToCountMap;
+    // write a block of raw binary labels
+    bool writeLabels(const PWP_UINT64 *labels, size_t count)
+    {
+        enum { ChunkSize = 64 };
+        PWP_INT64 lbls[ChunkSize];
+        bool ret = true;
+        while (ret && (0 < count)) {
+            const size_t n = std::min(count, (size_t)ChunkSize);
+            for (size_t ii = 0; ii < n; ++ii) {
+                checkLabel(labels[ii]);
+            }
+            ret = write(lbls, fmt_.encodeLabels(labels, n, lbls), 1);
+            labels += n;
+            count -= n;
+        }
+        return ret;
+    }
+
+private:
+    enum { BlockSizeWidth = 20 }; // width of a collated block size
+
+    // get the num bytes written to the file, including buffered bytes
+    PWP_UINT64 tell() const
+    {
+        return bytesWritten_ + bufLen_;
+    }
+
+    // get the file position of the next byte written
+    bool getPos(sysFILEPOS &pos)
+    {
+        return flush() && !pwpFileGetpos(fp_, &pos);
+    }
+
+    // overwrite a width wide value field at pos, the file position is kept
+    bool patch(const sysFILEPOS &pos, int width, PWP_UINT64 value)
+    {
+        char text[64];
+        const int len = sprintf(text, "%*llu", -width,
+            (unsigned long long)value);
+        sysFILEPOS savePos;
+        bool ret = getPos(savePos) && !pwpFileSetpos(fp_, &pos);
+        if (ret) {
+            ret = ((size_t)len == pwpFileWriteUnlocked(text, 1, len, fp_));
+            ret = !pwpFileSetpos(fp_, &savePos) && ret;
+        }
+        return ret;
+    }
+
+    // Write the decomposedBlockData container header for the first block and
+    // open the file's block. The block holds the complete uncollated file.
+    void writeBlockHeader()
+    {
+        if (0 == collatedBlock_) {
+            print(    "FoamFile\n");
+            print(    "{\n");
+            print(    "    version     %s;\n", version_.c_str());
+            print(    "    format      binary;\n");
+            print(    "    arch        \"%s\";\n", fmt_.arch().c_str());
+            print(    "    class       decomposedBlockData;\n");
+            print(    "    location    \"%s\";\n", location_.c_str());
+            print(    "    object      %s;\n", object_.c_str());
+            writeStr("}\n");
+            writeStr("\n");
+        }
+        print("\n// Processor%u\n", (unsigned)collatedBlock_);
+        getPos(blockPos_);
+        print("%*d\n", -BlockSizeWidth, 0);
+        writeStr("(");
+        blockStart_ = tell();
+    }
+
+    // callback for subclasses after the output file is opened successfully,
+    // return false to abort the open
+    virtual bool notifyOpen()
+    {
+        return true; // do nothing by default
+    }
+
+    // callback for subclasses that the output file is about to be closed
+    virtual void notifyClosing()
+    {
+        // do nothing by default
+    }
+
+    // callback for subclasses after the item list was closed, before the
+    // output file is closed
+    virtual void notifyListClosed()
+    {
+        // do nothing by default
+    }
+
+    // write standard file header for all OpenFOAM files
+    void writeFileHeader()
+    {
+        print(    "FoamFile\n");
+        print(    "{\n");
+        print(    "    version     %s;\n", version_.c_str());
+        print(    "    format      %s;\n", fmt_.name());
+        if (isBinary()) {
+            print("    arch        \"%s\";\n", fmt_.arch().c_str());
+        }
+        print(    "    class       %s;\n", class_.c_str());
+        print(    "    location    \"%s\";\n", location_.c_str());
+        print(    "    object      %s;\n", object_.c_str());
+        writeStr("}\n");
+        writeStr("\n");
+    }
+
+private:
+    std::string   class_;       // output file class name
+    std::string   object_;      // output file name
+    std::string   location_;    // ouput file location
+    std::string   version_;     // output file version
+    FoamFormat    fmt_;         // output file format
+    FILE        * fp_;          // underlying FILE
+    sysFILEPOS    pos_;         // file position of item counter
+    sysFILEPOS    blockPos_;    // file position of collated block size
+    PWP_UINT64    blockStart_;  // byte offset of collated block data
+    PWP_UINT64    bytesWritten_;// num bytes passed to the file
+    PWP_UINT64    numItems_;    // number of items written to the file
+    PWP_UINT64    expectedCount_; // item count given to open()
+    PWP_UINT64    maxLabel_;    // largest label written to the file
+    std::vector<char> buf_;     // output buffer
+    size_t        bufLen_;      // num bytes used in buf_
+    size_t        bufSize_;     // output buffer size used by open()
+    bool          compress_;    // true to compress if the count is known
+#if defined(HAVE_ZLIB)
+    GzipBlockWriter *gz_;       // compressor, null if not compressed
+#else
+    void        * gz_;          // always null
+#endif /* HAVE_ZLIB */
+
+    static std::string collatedRoot_; // collated output root, empty if none
+    static PWP_UINT32 collatedBlock_; // collated processor block
+};
+
+std::string FoamFile::collatedRoot_;
+PWP_UINT32 FoamFile::collatedBlock_ = 0;
+const PWP_UINT64 FoamFile::UnknownCount = ~(PWP_UINT64)0;
+
+
+/***************************************************************************
+ * Class RealFormatter converts floating point values to the shortest text
+ * that reads back as the same value. If the shortest text needs more than
+ * the requested number of significant digits, the value is rounded to that
+ * precision instead.
+ ***************************************************************************/
+class RealFormatter {
+public:
+    enum { BufSize = 32 }; // max num chars written for one value
+
+    // format v into buf, return a pointer past the last char written
+    static char * format(char *buf, PWP_REAL v, int prec)
+    {
+        return formatReal(buf, v, prec);
+    }
+
+    // format v into buf, return a pointer past the last char written
+    static char * format(char *buf, PWP_FLOAT v, int prec)
+    {
+        return formatReal(buf, v, prec);
+    }
+
+private:
+    template<typename T>
+    static char * formatReal(char *buf, T v, int prec)
+    {
+#if defined(HAVE_FLOAT_TO_CHARS)
+        char *end = std::to_chars(buf, buf + BufSize, v).ptr;
+        if (numDigits(buf, end) > prec) {
+            end = std::to_chars(buf, buf + BufSize, v,
+                std::chars_format::general, prec).ptr;
+        }
+        return end;
+#else
+        const int n = snprintf(buf, BufSize, "%.*g", prec, (double)v);
+        return buf + ((0 < n) ? std::min(n, BufSize - 1) : 0);
+#endif /* HAVE_FLOAT_TO_CHARS */
+    }
+
+    // count the significant digits in the text of a formatted value
+    static int numDigits(const char *buf, const char *end)
+    {
+        const char *first = 0;
+        const char *last = 0;
+        int cnt = 0;
+        int lastCnt = 0;
+        for (; (buf != end) && ('e' != *buf); ++buf) {
+            if (('1' <= *buf) && ('9' >= *buf)) {
+                if (0 == first) {
+                    first = buf;
+                }
+                last = buf;
+            }
+            if (first && ('0' <= *buf) && ('9' >= *buf)) {
+                ++cnt;
+                if (last == buf) {
+                    lastCnt = cnt;
+                }
+            }
+        }
+        return lastCnt;
+    }
+};
+
+
+/***************************************************************************
+ * Class PolyMesh holds an in-memory copy of the exported polyMesh for post
+ * processing, such as decomposition. Faces are stored as a compact list in
+ * file order. Only internal faces have a neighbour.
+ *
+ * Every label is 64 bits, so a hex mesh costs about 56 bytes per face and
+ * 24 bytes per point, or some 190 bytes per cell. The copy is refused when
+ * bytesFor() exceeds DecomposeMemorySize, so 10^8 cells need it raised to
+ * about 19000 MiB. Partitioning adds some 25 bytes per cell for the cell
+ * centroids and the face buckets of cellCentroids().
+ ***************************************************************************/
+class PolyMesh {
+
+    // ParallelFor body bucketing a range of faces by the cell ranges of
+    // their owner and neighbour. Run once with no faces_ to count each
+    // face range's share of each bucket in next_, and again to fill the
+    // buckets from the offsets put in next_. A face whose cells are both in
+    // one cell range is in its bucket once.
+    struct FaceBucketBody {
+        FaceBucketBody(const PolyMesh &mesh, PWP_UINT64 numCells,
+                PWP_UINT32 numCellRanges) :
+            mesh_(mesh),
+            scale_((double)numCellRanges / (double)numCells),
+            numCellRanges_(numCellRanges),
+            rangeEnd_(numCellRanges),
+            next_(ParallelFor::numRanges(mesh.numFaces()) * numCellRanges,
+                0),
+            faces_(0)
+        {
+            for (PWP_UINT32 cr = 0; cr < numCellRanges; ++cr) {
+                rangeEnd_[cr] = ParallelFor::rangeBegin(numCells,
+                    numCellRanges, cr + 1);
+            }
+        }
+
+        void operator()(PWP_UINT32 range, PWP_UINT64 begin, PWP_UINT64 end)
+        {
+            PWP_UINT64 *next = &next_[range * numCellRanges_];
+            const PWP_UINT64 numInternal = mesh_.numInternalFaces();
+            for (PWP_UINT64 ff = begin; ff < end; ++ff) {
+                const PWP_UINT32 ownRange = cellRange(mesh_.owner_[ff]);
+                add(next[ownRange], ff);
+                if (ff < numInternal) {
+                    const PWP_UINT32 neiRange =
+                        cellRange(mesh_.neighbour_[ff]);
+                    if (neiRange != ownRange) {
+                        add(next[neiRange], ff);
+                    }
+                }
+            }
+        }
+
+        // Turn the counts into the offsets each face range fills its part
+        // of each bucket from, and get the start of each bucket. The
+        // buckets keep the faces in order.
+        void countsToOffsets(std::vector<PWP_UINT64> &rangeStart)
+        {
+            const PWP_UINT32 numFaceRanges =
+                (PWP_UINT32)(next_.size() / numCellRanges_);
+            rangeStart.assign(numCellRanges_ + 1, 0);
+            PWP_UINT64 pos = 0;
+            for (PWP_UINT32 cr = 0; cr < numCellRanges_; ++cr) {
+                rangeStart[cr] = pos;
+                for (PWP_UINT32 fr = 0; fr < numFaceRanges; ++fr) {
+                    const PWP_UINT64 cnt = next_[fr * numCellRanges_ + cr];
+                    next_[fr * numCellRanges_ + cr] = pos;
+                    pos += cnt;
+                }
+            }
+            rangeStart[numCellRanges_] = pos;
+        }
+
+        // get the cell range of a cell, guessed from its index and then
+        // corrected
+        PWP_UINT32 cellRange(PWP_UINT64 cell) const
+        {
+            PWP_UINT32 range = std::min((PWP_UINT32)(cell * scale_),
+                numCellRanges_ - 1);
+            while ((0 < range) && (cell < rangeEnd_[range - 1])) {
+                --range;
+            }
+            while (cell >= rangeEnd_[range]) {
+                ++range;
+            }
+            return range;
+        }
+
+        // count a face, or put it in its bucket
+        void add(PWP_UINT64 &next, PWP_UINT64 face)
+        {
+            if (0 != faces_) {
+                (*faces_)[next] = (PWP_UINT32)face;
+            }
+            ++next;
+        }
+
+        const PolyMesh &            mesh_;          // the mesh
+        double                      scale_;         // cell ranges per cell
+        PWP_UINT32                  numCellRanges_; // num cell ranges
+        std::vector<PWP_UINT64>     rangeEnd_;      // end of each cell range
+        std::vector<PWP_UINT64>     next_;          // face range counts
+        std::vector<PWP_UINT32> *   faces_;         // buckets, null to count
+    };
+
+    // ParallelFor body summing the face centres of a range of cells. Each
+    // range only reads the faces in its own bucket, or all faces if there
+    // are no buckets.
+    struct CentroidBody {
+        CentroidBody(const PolyMesh &mesh,
+                const std::vector<PWP_UINT64> &rangeStart,
+                const std::vector<PWP_UINT32> &rangeFaces,
+                std::vector<float> &centroids,
+                std::vector<unsigned char> &numCellFaces) :
+            mesh_(mesh),
+            rangeStart_(rangeStart),
+            rangeFaces_(rangeFaces),
+            centroids_(centroids),
+            numCellFaces_(numCellFaces)
+        {
+        }
+
+        void operator()(PWP_UINT32 range, PWP_UINT64 begin, PWP_UINT64 end)
+        {
+            const PWP_UINT64 numInternal = mesh_.numInternalFaces();
+            const bool isBucketed = !rangeStart_.empty();
+            const PWP_UINT64 first = isBucketed ? rangeStart_[range] : 0;
+            const PWP_UINT64 last = isBucketed ? rangeStart_[range + 1] :
+                mesh_.numFaces();
+            for (PWP_UINT64 ii = first; ii < last; ++ii) {
+                const PWP_UINT64 ff = isBucketed ? rangeFaces_[ii] : ii;
+                const PWP_UINT64 own = mesh_.owner_[ff];
+                const PWP_UINT64 nei = (ff < numInternal) ?
+                    mesh_.neighbour_[ff] : end;
+                PWGM_XYZVAL fc[3];
+                mesh_.faceCentre(ff, fc);
+                if ((own >= begin) && (own < end)) {
+                    add(own, fc);
+                }
+                if ((nei >= begin) && (nei < end)) {
+                    add(nei, fc);
+                }
+            }
+            for (PWP_UINT64 cell = begin; cell < end; ++cell) {
+                if (0 != numCellFaces_[cell]) {
+                    const float n = (float)numCellFaces_[cell];
+                    centroids_[3 * cell] /= n;
+                    centroids_[3 * cell + 1] /= n;
+                    centroids_[3 * cell + 2] /= n;
+                }
+            }
+        }
+
+        // add a face centre to a cell
+        void add(PWP_UINT64 cell, const PWGM_XYZVAL fc[3])
+        {
+            centroids_[3 * cell] += (float)fc[0];
+            centroids_[3 * cell + 1] += (float)fc[1];
+            centroids_[3 * cell + 2] += (float)fc[2];
+            if (std::numeric_limits<unsigned char>::max() !=
+                    numCellFaces_[cell]) {
+                ++numCellFaces_[cell];
+            }
+        }
+
+        const PolyMesh &                mesh_;          // the mesh
+        const std::vector<PWP_UINT64> & rangeStart_;    // bucket offsets
+        const std::vector<PWP_UINT32> & rangeFaces_;    // faces by range
+        std::vector<float> &            centroids_;     // x, y, z of cells
+        std::vector<unsigned char> &    numCellFaces_;  // faces of cells
+    };
+
+public:
+    // Default constructor
+    PolyMesh() :
+        faceStart_(1, 0),
+        faceVerts_(),
+        owner_(),
+        neighbour_(),
+        points_()
+    {
+    }
+
+    // destructor
+    ~PolyMesh()
+    {
+    }
+
+    // get the approximate size of a copy, taking 4 vertices per face
+    static PWP_UINT64 bytesFor(PWP_UINT64 numFaces, PWP_UINT64 numInternal,
+        PWP_UINT64 numPoints)
+    {
+        return sizeof(PWP_UINT64) * (6 * numFaces + numInternal) +
+            3 * sizeof(PWGM_XYZVAL) * numPoints;
+    }
+
+    // allocate the face and point lists up front so they do not grow by
+    // doubling
+    void reserve(PWP_UINT64 numFaces, PWP_UINT64 numInternal,
+        PWP_UINT64 numPoints)
+    {
+        faceStart_.reserve((size_t)numFaces + 1);
+        owner_.reserve((size_t)numFaces);
+        neighbour_.reserve((size_t)numInternal);
+        points_.reserve(3 * (size_t)numPoints);
+    }
+
+    // append a face given its OpenFOAM ordered vertex indices
+    void addFace(const PWP_UINT64 ndx[], PWP_UINT32 cnt)
+    {
+        faceVerts_.insert(faceVerts_.end(), ndx, ndx + cnt);
+        faceStart_.push_back(faceVerts_.size());
+    }
+
+    // append a point
+    void addPoint(const PWGM_VERTDATA &v)
+    {
+        points_.push_back(v.x);
+        points_.push_back(v.y);
+        points_.push_back(v.z);
+    }
+
+    // get the number of faces
+    PWP_UINT64 numFaces() const
+    {
+        return faceStart_.size() - 1;
+    }
+
+    // get the number of internal faces
+    PWP_UINT64 numInternalFaces() const
+    {
+        return neighbour_.size();
+    }
+
+    // get the number of points
+    PWP_UINT64 numPoints() const
+    {
+        return points_.size() / 3;
+    }
+
+    // get the number of cells
+    PWP_UINT64 numCells() const
+    {
+        PWP_UINT64 ret = 0;
+        for (size_t ii = 0; ii < owner_.size(); ++ii) {
+            ret = std::max(ret, owner_[ii] + 1);
+        }
+        for (size_t ii = 0; ii < neighbour_.size(); ++ii) {
+            ret = std::max(ret, neighbour_[ii] + 1);
+        }
+        return ret;
+    }
+
+    // Compute the approximate centre of each cell as the average of its face
+    // centres, stored as float x, y, z triples, and its number of faces.
+    // The cells are split into one range per thread. Unless there is only
+    // one, the faces are bucketed by the cell ranges of their owner and
+    // neighbour in two concurrent passes over the faces, then the cell
+    // ranges sum the faces of their buckets concurrently. Each cell sums
+    // its faces in file order, so the result does not depend on the number
+    // of threads. Face indices fit 32 bits as the face stream's do.
+    void cellCentroids(std::vector<float> &centroids,
+        std::vector<unsigned char> &numCellFaces) const
+    {
+        const PWP_UINT64 numCellsVal = numCells();
+        centroids.assign(3 * (size_t)numCellsVal, 0.0f);
+        numCellFaces.assign((size_t)numCellsVal, 0);
+        const PWP_UINT64 numThreads = ParallelFor::numThreads();
+        const PWP_UINT64 grain = (numCellsVal + numThreads - 1) / numThreads;
+        const PWP_UINT32 numCellRanges = ParallelFor::numRanges(numCellsVal,
+            grain);
+        std::vector<PWP_UINT64> rangeStart;
+        std::vector<PWP_UINT32> rangeFaces;
+        if (1 < numCellRanges) {
+            FaceBucketBody bucketBody(*this, numCellsVal, numCellRanges);
+            ParallelFor::run(numFaces(), bucketBody);
+            bucketBody.countsToOffsets(rangeStart);
+            rangeFaces.resize((size_t)rangeStart[numCellRanges]);
+            bucketBody.faces_ = &rangeFaces;
+            ParallelFor::run(numFaces(), bucketBody);
+        }
+        CentroidBody body(*this, rangeStart, rangeFaces, centroids,
+            numCellFaces);
+        ParallelFor::run(numCellsVal, body, grain);
+    }
+
+    // compute the average of a face's vertices
+    void faceCentre(PWP_UINT64 face, PWGM_XYZVAL fc[3]) const
+    {
+        fc[0] = fc[1] = fc[2] = 0.0;
+        const PWP_UINT64 first = faceStart_[face];
+        const PWP_UINT64 last = faceStart_[face + 1];
+        for (PWP_UINT64 ii = first; ii < last; ++ii) {
+            const PWGM_XYZVAL *xyz = &points_[3 * faceVerts_[ii]];
+            fc[0] += xyz[0];
+            fc[1] += xyz[1];
+            fc[2] += xyz[2];
+        }
+        if (last > first) {
+            const PWGM_XYZVAL n = (PWGM_XYZVAL)(last - first);
+            fc[0] /= n;
+            fc[1] /= n;
+            fc[2] /= n;
+        }
+    }
+
+    std::vector<PWP_UINT64>     faceStart_; // offset of each face's vertices
+    std::vector<PWP_UINT64>     faceVerts_; // vertices of all faces
+    std::vector<PWP_UINT64>     owner_;     // owner cell of each face
+    std::vector<PWP_UINT64>     neighbour_; // neighbour of internal faces
+    std::vector<PWGM_XYZVAL>    points_;    // x, y, z of each point
+};
+
+
+/***************************************************************************
+ * Class FoamPointFile writes an OpenFOAM "points" file. The points file
+ * contains all mesh global vertices.
+ ***************************************************************************/
+class FoamPointFile : public FoamFile {
+public:
+    // Default constructor, set class name and file name
+    FoamPointFile(PWP_UINT prec, const FoamFormat &fmt) :
+        FoamFile("vectorField", "points", fmt),
+        prec_(isSingle() ? std::min(prec, PointPrecisionSingleMax) : prec),
+        capture_(0)
+    {
+    }
+
+    // destructor
+    virtual ~FoamPointFile()
+    {
+    }
+
+
+    // write vertex to points file, one per line
+    // (x y z)
+    inline void
+    writeVertex(const PWGM_VERTDATA &v)
+    {
+        if (0 != capture_) {
+            capture_->addPoint(v);
+        }
+        if (!isSingle()) {
+            writeVertex(v.x, v.y, v.z);
+        }
+        else if (isBinary()) {
+            const PWP_FLOAT xyz[3] = { (PWP_FLOAT)v.x, (PWP_FLOAT)v.y,
+                (PWP_FLOAT)v.z };
+            write(xyz, sizeof(xyz[0]), 3);
+            incrNumItems();
+        }
+        else {
+            writeAsciiVertex((PWP_FLOAT)v.x, (PWP_FLOAT)v.y, (PWP_FLOAT)v.z);
+        }
+    }
+
+
+    // copy all points written after this call to mesh, null to stop
+    void setCapture(PolyMesh *mesh)
+    {
+        capture_ = mesh;
+    }
+
+    // write global vertex to points file
+    inline void
+    writeVertex(const PWGM_HVERTEX h)
+    {
+        PWGM_VERTDATA v;
+        if (PwVertDataMod(h, &v)) {
+            writeVertex(v);
+        }
+    }
+
+
+    // write global vertex to points file
+    void writeVertex(const PWGM_HVERTEX h, const PWGM_XYZVAL newZ)
+    {
+        PWGM_VERTDATA v;
+        if (PwVertDataMod(h, &v)) {
+            v.z = newZ;
+            writeVertex(v);
+        }
+    }
+
+
+private:
+
+    // return whether points are written in single precision
+    bool isSingle() const
+    {
+        return 32 == format().scalarSize_;
+    }
+
+    // write vertex components to points file
+    void writeVertex(PWP_REAL x, PWP_REAL y, PWP_REAL z)
+    {
+        if (isBinary()) {
+            const PWP_REAL xyz[3] = { x, y, z };
+            write(xyz, sizeof(xyz[0]), 3);
+            incrNumItems();
+        }
+        else {
+            writeAsciiVertex(x, y, z);
+        }
+    }
+
+    // format the vertex line in a local buffer and write it in one call
+    template<typename T>
+    void writeAsciiVertex(T x, T y, T z)
+    {
+        const int p = (int)prec_;
+        char line[3 * RealFormatter::BufSize + 8];
+        char *end = line;
+        *end++ = '(';
+        end = RealFormatter::format(end, x, p);
+        *end++ = ' ';
+        end = RealFormatter::format(end, y, p);
+        *end++ = ' ';
+        end = RealFormatter::format(end, z, p);
+        *end++ = ')';
+        *end++ = '\n';
+        write(line, 1, end - line);
+        incrNumItems();
+    }
+
+    PWP_UINT    prec_;
+    PolyMesh *  capture_;   // receives a copy of each point, or null
+};
+
+
+/***************************************************************************
+ * Class FoamFacesFile write an OpenFOAM "faces" file. The faces file
+ * contains cell face information as a list of global vertex indices.
+ * A face is written as the number of vertices followed by the list of
+ * vertices that comprise the face (quad, tri or bar).
+ *
+ * In compact mode, the file is written as a "faceCompactList". That is, a
+ * list of the offsets of each face's first vertex followed by the flat list
+ * of all face vertices. The offsets are written to this file as the faces
+ * arrive. The vertices are written to a side file that is appended to this
+ * file when it is closed.
+ ***************************************************************************/
+class FoamFacesFile : public FoamFile {
+
+    enum { ItemsPerRow = 10 }; // max num labels per line in compact lists
+
+public:
+    // Default constructor, set class and file name
+    FoamFacesFile(bool is2D, PWP_UINT64 vertexCount, const FoamFormat &fmt) :
+        FoamFile("faceList", "faces", fmt),
+        vertexCount_(vertexCount),
+        is2D_(is2D),
+        compact_(false),
+        labelsFp_(0),
+        labelsBuf_(),
+        labelsLen_(0),
+        labelCnt_(0),
+        offsetRowCnt_(0),
+        labelRowCnt_(0),
+        capture_(0),
+        pointNew_(0),
+        numPointsUsed_(0)
+    {
+    }
+
+    // destructor
+    virtual ~FoamFacesFile()
+    {
+        // close here to get the compact list callbacks
+        close();
+    }
+
+    // write the file as a faceCompactList instead of a faceList
+    void setCompact(bool compact)
+    {
+        compact_ = compact;
+        setClass(compact_ ? "faceCompactList" : "faceList");
+    }
+
+    // return whether the file is written as a faceCompactList
+    bool isCompact() const
+    {
+        return compact_;
+    }
+
+    // open the file for numFaces faces, a faceCompactList has one more
+    // offset than faces
+    bool openFaces(PWP_UINT64 numFaces)
+    {
+        return open(0, numFaces + (compact_ ? 1 : 0));
+    }
+
+    // write a cell face to the faces file, vertOffset is added to the face's
+    // vertex indices
+    void writeFace(const PWGM_ELEMDATA &eData, PWP_UINT64 vertOffset = 0)
+    {
+        PWP_UINT64 ndx[4];
+        const PWP_UINT32 cnt = faceIndices(eData, ndx, vertOffset);
+        if (0 != cnt) {
+            writeFace(ndx, cnt);
+        }
+    }
+
+    // get the OpenFOAM ordered vertex indices of a cell face, vertOffset is
+    // added to the face's vertex indices. Returns the number of indices.
+    PWP_UINT32 faceIndices(const PWGM_ELEMDATA &eData, PWP_UINT64 ndx[4],
+        PWP_UINT64 vertOffset = 0) const
+    {
+        // The PW cell-face owner/bndry model has the face normals pointing
+        // to the interior of the owner cell. Due to the way cells are
+        // processed during streaming, the owner cell will always have a lower
+        // cell id. The OpenFOAM spec requires an internal face normal to point
+        // from the lower numbered cell to the higher numbered cell. Boundary
+        // face normals must point outside the volume. Basically, the
+        // exact opposite of PW.
+
+        PWP_UINT32 cnt = 0;
+        switch (eData.type) {
+        case PWGM_ELEMTYPE_QUAD:
+            ndx[cnt++] = eData.index[3];
+            ndx[cnt++] = eData.index[2];
+            ndx[cnt++] = eData.index[1];
+            ndx[cnt++] = eData.index[0];
+            break;
+        case PWGM_ELEMTYPE_TRI:
+            ndx[cnt++] = eData.index[2];
+            ndx[cnt++] = eData.index[1];
+            ndx[cnt++] = eData.index[0];
+            break;
+        case PWGM_ELEMTYPE_BAR:
+            if (is2D_) {
+                ndx[cnt++] = eData.index[0];
+                ndx[cnt++] = eData.index[1];
+                ndx[cnt++] = eData.index[1] + vertexCount_;
+                ndx[cnt++] = eData.index[0] + vertexCount_;
+            }
+            else {
+                ndx[cnt++] = eData.index[1];
+                ndx[cnt++] = eData.index[0];
+            }
+            break;
+        default:
+            break;
+        }
+        for (PWP_UINT32 ii = 0; ii < cnt; ++ii) {
+            ndx[ii] += vertOffset;
+        }
+        return cnt;
+    }
+
+    // write a face given its OpenFOAM ordered vertex indices
+    void writeFace(const PWP_UINT64 ndx[], PWP_UINT32 cnt)
+    {
+        PWP_UINT64 newNdx[4];
+        if ((0 != pointNew_) && (cnt <= 4)) {
+            for (PWP_UINT32 ii = 0; ii < cnt; ++ii) {
+                newNdx[ii] = usePoint(ndx[ii]);
+            }
+            ndx = newNdx;
+        }
+        if (0 != capture_) {
+            capture_->addFace(ndx, cnt);
+        }
+        if (compact_) {
+            writeCompactFace(ndx, cnt);
+        }
+        else {
+            writeListFace(ndx, cnt);
+        }
+        incrNumItems();
+    }
+
+    // copy all faces written after this call to mesh, null to stop
+    void setCapture(PolyMesh *mesh)
+    {
+        capture_ = mesh;
+    }
+
+    // Renumber the points in order of first use by the faces written after
+    // this call. pointNew must have an UnusedPoint entry per point and
+    // receives each used point's new index. Null to stop.
+    void setPointRenumbering(std::vector<PWP_UINT64> *pointNew)
+    {
+        pointNew_ = pointNew;
+        numPointsUsed_ = 0;
+    }
+
+    // get the number of points given a new index
+    PWP_UINT64 getNumPointsUsed() const
+    {
+        return numPointsUsed_;
+    }
+
+    static const PWP_UINT64 UnusedPoint; // point not used by a face yet
+
+private:
+    // get the new index of a point, numbering it if first used
+    PWP_UINT64 usePoint(PWP_UINT64 point)
+    {
+        PWP_UINT64 &ndx = (*pointNew_)[point];
+        if (UnusedPoint == ndx) {
+            ndx = numPointsUsed_++;
+        }
+        return ndx;
+    }
+
+    // write a face as its vertex count followed by its vertex indices
+    void writeListFace(const PWP_UINT64 ndx[], PWP_UINT32 cnt)
+    {
+        // "N(" followed by the labels
+        char *p = reserve(cnt * (LabelFormatter::BufSize + 1) + 16);
+        p = LabelFormatter::format(p, cnt);
+        *p++ = '(';
+        if (isBinary()) {
+            commit(p);
+            writeLabels(ndx, cnt);
+            p = reserve(2);
+        }
+        else {
+            for (PWP_UINT32 ii = 0; ii < cnt; ++ii) {
+                checkLabel(ndx[ii]);
+                if (0 != ii) {
+                    *p++ = ' ';
+                }
+                p = LabelFormatter::format(p, ndx[ii]);
+            }
+        }
+        *p++ = ')';
+        *p++ = '\n';
+        commit(p);
+    }
+
+    // write a face's offset to this file and its vertices to the side file
+    void writeCompactFace(const PWP_UINT64 ndx[], PWP_UINT32 cnt)
+    {
+        for (PWP_UINT32 ii = 0; ii < cnt; ++ii) {
+            checkLabel(ndx[ii]);
+        }
+        char *p = reserveLabels(4 * (LabelFormatter::BufSize + 2));
+        if (isBinary()) {
+            writeLabel(labelCnt_);
+            PWP_INT64 lbls[4];
+            const size_t len = format().encodeLabels(ndx, cnt, lbls);
+            memcpy(p, lbls, len);
+            p += len;
+        }
+        else {
+            checkLabel(labelCnt_);
+            char *q = reserve(LabelFormatter::BufSize + 2);
+            commit(LabelFormatter::formatRowItem(q, labelCnt_, offsetRowCnt_,
+                ItemsPerRow));
+            for (PWP_UINT32 ii = 0; ii < cnt; ++ii) {
+                p = LabelFormatter::formatRowItem(p, ndx[ii], labelRowCnt_,
+                    ItemsPerRow);
+            }
+        }
+        labelsLen_ = (size_t)(p - &labelsBuf_[0]);
+        labelCnt_ += cnt;
+    }
+
+    // get a pointer to at least size free bytes in the side file buffer
+    char * reserveLabels(size_t size)
+    {
+        if (labelsLen_ + size > labelsBuf_.size()) {
+            flushLabels();
+        }
+        return &labelsBuf_[0] + labelsLen_;
+    }
+
+    // write the side file buffer contents to the side file
+    bool flushLabels()
+    {
+        bool ret = true;
+        if (0 != labelsLen_) {
+            ret = (labelsLen_ == pwpFileWriteUnlocked(&labelsBuf_[0], 1,
+                labelsLen_, labelsFp_));
+            labelsLen_ = 0;
+        }
+        return ret;
+    }
+
+    // name of the compact list vertices side file
+    std::string labelsFileName() const
+    {
+        return std::string(object()) + ".labels";
+    }
+
+    // inherited callback to create the compact list side file
+    virtual bool notifyOpen()
+    {
+        labelCnt_ = 0;
+        offsetRowCnt_ = 0;
+        labelRowCnt_ = 0;
+        labelsLen_ = 0;
+        if (compact_) {
+            labelsFp_ = pwpFileOpen(labelsFileName().c_str(),
+                pwpWrite | pwpBinary);
+        }
+        if (0 != labelsFp_) {
+            setvbuf(labelsFp_, 0, _IONBF, 0);
+            labelsBuf_.resize(getBufferSize());
+        }
+        return !compact_ || (0 != labelsFp_);
+    }
+
+    // inherited callback to write the final offset
+    virtual void notifyClosing()
+    {
+        if (!compact_) {
+            // nothing to do
+        }
+        else if (isBinary()) {
+            writeLabel(labelCnt_);
+            incrNumItems();
+        }
+        else {
+            checkLabel(labelCnt_);
+            char *p = reserve(LabelFormatter::BufSize + 3);
+            p = LabelFormatter::formatRowItem(p, labelCnt_, offsetRowCnt_,
+                ItemsPerRow);
+            if (0 != offsetRowCnt_) {
+                *p++ = '\n';
+            }
+            commit(p);
+            incrNumItems();
+            if (0 != labelRowCnt_) {
+                *reserveLabels(1) = '\n';
+                ++labelsLen_;
+            }
+        }
+    }
+
+    // inherited callback to append the vertices from the side file
+    virtual void notifyListClosed()
+    {
+        if (0 == labelsFp_) {
+            return;
+        }
+        flushLabels();
+        pwpFileClose(labelsFp_);
+        labelsFp_ = 0;
+        const std::string labelsName = labelsFileName();
+        print("%llu\n", (unsigned long long)labelCnt_);
+        writeStr((isBinary() ? "(" : "(\n"));
+        FILE *fp = pwpFileOpen(labelsName.c_str(), pwpRead | pwpBinary);
+        if (0 != fp) {
+            // reuse the side file buffer to copy the labels
+            size_t n;
+            while (0 < (n = pwpFileRead(&labelsBuf_[0], 1, labelsBuf_.size(),
+                    fp))) {
+                write(&labelsBuf_[0], 1, n);
+            }
+            pwpFileClose(fp);
+        }
+        writeStr(")\n");
+        pwpFileDelete(labelsName.c_str());
+        std::vector<char>().swap(labelsBuf_);
+    }
+
+    PWP_UINT64  vertexCount_;     // Total number of vertices in file
+    PWP_BOOL    is2D_;            // Is the file 2D?
+    bool        compact_;         // true if writing a faceCompactList
+    FILE *      labelsFp_;        // compact list vertices side file
+    std::vector<char> labelsBuf_; // side file output buffer
+    size_t      labelsLen_;       // num bytes used in labelsBuf_
+    PWP_UINT64  labelCnt_;        // number of compact list vertices written
+    PWP_UINT32  offsetRowCnt_;    // num offsets in current ascii row
+    PWP_UINT32  labelRowCnt_;     // num vertices in current ascii row
+    PolyMesh *  capture_;         // receives a copy of each face, or null
+    std::vector<PWP_UINT64> *pointNew_; // new index of each point, or null
+    PWP_UINT64  numPointsUsed_;   // num points given a new index
+};
+
+const PWP_UINT64 FoamFacesFile::UnusedPoint = ~(PWP_UINT64)0;
+
+
+/***************************************************************************
+ * Base Class FoamAddressFile is used to write OpenFOAM cell topology
+ * information.
+ ***************************************************************************/
+class FoamAddressFile : public FoamFile {
+
+    enum { ItemsPerRow = 10 }; // max num addresses per line
+
+public:
+    // Constructor, set class type as "labelList"
+    FoamAddressFile(const char *object, const FoamFormat &fmt,
+            const char *location = 0) :
+        FoamFile("labelList", object, fmt, location),
+        rowCnt_(0),
+        capture_(0)
+    {
+    }
+
+    // Destructor, forces end-of-line for partially filled rows
+    virtual ~FoamAddressFile()
+    {
+        cleanup();
+    }
+
+    // write an address to the current row in the file, adding a row as needed
+    void writeAddress(PWP_UINT64 addr)
+    {
+        if (0 != capture_) {
+            capture_->push_back(addr);
+        }
+        if (isBinary()) {
+            writeLabel(addr);
+        }
+        else {
+            checkLabel(addr);
+            char *p = reserve(LabelFormatter::BufSize + 2);
+            commit(LabelFormatter::formatRowItem(p, addr, rowCnt_,
+                ItemsPerRow));
+        }
+        incrNumItems();
+    }
+
+    // write a signed address, such as a flipped face in faceProcAddressing
+    void writeSignedAddress(PWP_INT64 addr)
+    {
+        const PWP_UINT64 mag = (PWP_UINT64)((addr < 0) ? -addr : addr);
+        checkLabel(mag);
+        if (isBinary()) {
+            const PWP_UINT64 lbl = (PWP_UINT64)addr;
+            PWP_INT64 buf;
+            write(&buf, format().encodeLabels(&lbl, 1, &buf), 1);
+        }
+        else {
+            char *p = reserve(LabelFormatter::BufSize + 3);
+            *p++ = ' ';
+            if (addr < 0) {
+                *p++ = '-';
+            }
+            p = LabelFormatter::format(p, mag);
+            if (ItemsPerRow == ++rowCnt_) {
+                *p++ = '\n';
+                rowCnt_ = 0;
+            }
+            commit(p);
+        }
+        incrNumItems();
+    }
+
+    // copy all addresses written after this call to addrs, null to stop
+    void setCapture(std::vector<PWP_UINT64> *addrs)
+    {
+        capture_ = addrs;
+    }
+
+private:
+    // close partial row
+    void cleanup()
+    {
+        if (isOpen() && !isBinary()) {
+            if (0 != rowCnt_) {
+                writeStr("\n");
+                rowCnt_ = 0;
+            }
+        }
+    }
+
+    // inherited callback to start a new row
+    virtual bool notifyOpen()
+    {
+        rowCnt_ = 0;
+        return true;
+    }
+
+    // inherited callback to force end-of-row cleanup
+    virtual void notifyClosing()
+    {
+        cleanup();
+    }
+
+private:
+    PWP_UINT32  rowCnt_;    // num addresses in current ascii row
+    std::vector<PWP_UINT64> *capture_; // receives a copy of each address
+};
+
+
+/***************************************************************************
+ * Class FoamOwnerFile writes an OpenFOAM "owner" file. This file
+ * maps face index to owner cell index.
+ ***************************************************************************/
+class FoamOwnerFile : public FoamAddressFile {
+public:
+    // Default constructor, sets object to "owner"
+    FoamOwnerFile(const FoamFormat &fmt) :
+        FoamAddressFile("owner", fmt)
+    {
+    }
+
+    // destructor
+    virtual ~FoamOwnerFile()
+    {
+    }
+};
+
+
+/***************************************************************************
+ * Class FoamNeighbourFile writes an OpenFOAM "neighbour" file. This file
+ * maps face index to the neighbour cell index, if any. (Boundary faces do
+ * not have neighbour cells.)
+ ***************************************************************************/
+class FoamNeighbourFile : public FoamAddressFile {
+public:
+    // Default constructor, sets object to "neighbour"
+    FoamNeighbourFile(const FoamFormat &fmt) :
+        FoamAddressFile("neighbour", fmt)
+    {
+    }
+
+    // destructor
+    virtual ~FoamNeighbourFile()
+    {
+    }
+};
+
+
+/***************************************************************************
+ * Base class FoamSetFile writes an OpenFOAM "sets" file. A sets file
+ * is a list of object (cell or face) indices.
+ ***************************************************************************/
+class FoamSetFile : public FoamAddressFile {
+public:
+    // Constructor, sets location to "sets" directory
+    FoamSetFile(const char *cls, const FoamFormat &fmt) :
+        FoamAddressFile("", fmt, "constant/polyMesh/sets")
+    {
+        setClass(cls);
+    }
+
+    // destructor
+    virtual ~FoamSetFile()
+    {
+    }
+
+    // get the path of a set file relative to the "polyMesh" directory
+    static std::string path(const std::string &name)
+    {
+        return "sets/" + name;
+    }
+};
+
+
+/***************************************************************************
+ * Class FoamCellSetFile writes an OpenFOAM "cellSet" file. A cellSet file
+ * contains a list of cell indices for a given set.
+ ***************************************************************************/
+class FoamCellSetFile : public FoamSetFile {
+public:
+    // Default constructor sets class to "cellSet"
+    FoamCellSetFile(const FoamFormat &fmt) :
+        FoamSetFile("cellSet", fmt)
+    {
+    }
+
+    // destructor
+    virtual ~FoamCellSetFile()
+    {
+    }
+};
+
+
+/***************************************************************************
+ * Class FoamFaceSetFile writes an OpenFOAM "faceSet" file. A faceSet file
+ * contains a list of face indices for a given set.
+ ***************************************************************************/
+class FoamFaceSetFile : public FoamSetFile {
+public:
+    // Default constructor, sets class to "faceSet"
+    FoamFaceSetFile(const FoamFormat &fmt) :
+        FoamSetFile("faceSet", fmt)
+    {
+    }
+
+    // destructor
+    virtual ~FoamFaceSetFile()
+    {
+    }
+};
+
+typedef std::map<const char*, FoamCellSetFile*> VcNameToFile;
+typedef std::map<FoamCellSetFile*, PWP_UINT32>  FileToCountMap;
+
+
+/***************************************************************************
+ * Base Class FoamZoneFile is used to write various OpenFOAM "zone" files.
+ * A zone file contains sets of faces or cells with various attributes.
+ * Zone files are used to defined volume and boundary conditions.
+ ***************************************************************************/
+class FoamZoneFile : public FoamFile {
+public:
+    // Constructor sets class to "regIOobject" and location to polyMesh
+    // directory. The zone file is always ascii. The setFmt is the format
+    // used to write the set files that are read by writeSet().
+    FoamZoneFile(const char *object, const FoamFormat &setFmt) :
+        FoamFile("regIOobject", object, FoamFormat(), "constant/polyMesh"),
+        setFmt_(setFmt)
+    {
+    }
+
+    // destructor
+    virtual ~FoamZoneFile()
+    {
+    }
+
+    // write the address section of the set file with the given name to the
+    // zone file
+    bool writeSet(const std::string &setName)
+    {
+        // Parsing logic assumes a set file of format:
+        //
+        // FoamFile
+        // {
+        //     version     2.0;
+        //     format      ascii;
+        //     location    "constant/polyMesh/sets";
+        //     class       cellSet;
+        //     object      blade;
+        // }
+        //
+        // // * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * //
+        //
+        // 4807  <-- start writing here
+        // (
+        //  9947  9948  9949  9950  9951  9952  9953  9954  9955  9956
+        //  9957  9958  9959  9960  9961  9962  9963  9964  9965  9966
+        //  ...
+        // 14737 14738 14739 14740 14741 14742 14743 14744 14745 14746
+        // 14747 14748 14749 14750 14751 14752 14753 )  <-- end writing here
+
+        bool ret = false;
+        if (0 != getNumItems()) {
+            print("\n");
+        }
+
+        print("%s\n", setName.c_str());
+        writeStr("{\n");
+        // allow subclass to write custom data before label list
+        this->writeLabelListPrefix();
+        FILE *setFile = pwpFileOpen(FoamSetFile::path(setName).c_str(),
+            pwpRead | (setFmt_.binary_ ? pwpBinary : pwpAscii));
+        unsigned long long labelCnt = 0;
+
+        if (0 != setFile) {
+            ret = true;
+            // search setFile until we find a line starting with a digit char
+            char buf[1024];
+            fgets(buf, sizeof(buf), setFile);
+            while (!pwpFileEof(setFile)) {
+                // sscanf handles possible leading/trailing whitespace
+                if (1 == sscanf(buf, " %llu \n", &labelCnt)) {
+                    break;
+                }
+                fgets(buf, sizeof(buf), setFile);
+            }
+            if (setFmt_.binary_) {
+                // write the count line and convert the raw labels to text
+                print("  %s", buf);
+                ret = !pwpFileEof(setFile) && writeBinaryLabels(setFile,
+                    labelCnt);
+            }
+            else {
+                // write lines until we find one ending with a ')' char
+                while (!pwpFileEof(setFile)) {
+                    print("  %s", buf);
+                    if (0 != strrchr(buf, ')')) {
+                        break; // last line written - stop
+                    }
+                    fgets(buf, sizeof(buf), setFile);
+                }
+                ret = !pwpFileEof(setFile);
+            }
+            pwpFileClose(setFile);
+        }
+        // mark end of label list
+        writeStr("  ;\n");
+        // allow subclass to write custom data after label list
+        this->writeLabelListSuffix(labelCnt);
+        // mark end of zone
+        writeStr("}\n");
+        incrNumItems();
+        return ret;
+    }
+
+private:
+    // Read labelCnt raw labels from a binary set file positioned at the
+    // list's open paren. Write them to the zone file as an ascii list.
+    bool writeBinaryLabels(FILE *setFile, unsigned long long labelCnt)
+    {
+        enum { ItemsPerRow = 10 }; // max num labels per line
+        bool ret = ('(' == fgetc(setFile));
+        writeStr("  (\n");
+        PWP_INT64 buf[ItemsPerRow];
+        PWP_UINT64 labels[ItemsPerRow];
+        const size_t labelBytes = setFmt_.labelBytes();
+        while (ret && (0 < labelCnt)) {
+            const size_t n = (size_t)std::min(labelCnt,
+                (unsigned long long)ItemsPerRow);
+            if (n != pwpFileRead(buf, labelBytes, n, setFile)) {
+                ret = false;
+                break;
+            }
+            setFmt_.decodeLabels(buf, n, labels);
+            char *p = reserve(n * (LabelFormatter::BufSize + 1) + 3);
+            *p++ = ' ';
+            *p++ = ' ';
+            for (size_t ii = 0; ii < n; ++ii) {
+                *p++ = ' ';
+                p = LabelFormatter::format(p, labels[ii]);
+            }
+            *p++ = '\n';
+            commit(p);
+            labelCnt -= n;
+        }
+        writeStr("  )\n");
+        return ret;
+    }
+
+    // write zone label list to file
+    virtual void writeLabelListPrefix()
+    {
+        // assumes object_ is of form "xxxxZones"
+        // write as "xxxxZone" (singular)
+        print("  type %8.8s;\n", object());
+        // write as "xxxx"
+        print("  %4.4sLabels List<label>\n", object());
+    }
+
+    // allow subclass to write information after label list
+    virtual void writeLabelListSuffix(unsigned long long labelCnt)
+    {
+        (void)labelCnt; // do nothing
+    }
+
+private:
+    FoamFormat  setFmt_;    // format of the set files read by writeSet()
+};
+
+
+/***************************************************************************
+ * Class FoamCellZoneFile is used to write an OpenFOAM "cellZones" file.
+ * A cell zone contains cells with the same volume condition.
+ ***************************************************************************/
+class FoamCellZoneFile : public FoamZoneFile {
+public:
+    // Default constructor sets object to "cellZones"
+    FoamCellZoneFile(const FoamFormat &setFmt) :
+        FoamZoneFile("cellZones", setFmt)
+    {
+    }
+
+    // destructor
+    virtual ~FoamCellZoneFile()
+    {
+    }
+};
+
+
+/***************************************************************************
+ * Class FoamFaceZoneFile is used to write an OpenFOAM "faceZones" file.
+ * A face zone contains faces with the same boundary condition.
+ ***************************************************************************/
+class FoamFaceZoneFile : public FoamZoneFile {
+public:
+    // Default constructor sets object to "faceZones"
+    FoamFaceZoneFile(const FoamFormat &setFmt) :
+        FoamZoneFile("faceZones", setFmt)
+    {
+    }
+
+    // destructor
+    virtual ~FoamFaceZoneFile()
+    {
+    }
+
+private:
+    // callback from parent class after face zones have been written
+    virtual void writeLabelListSuffix(unsigned long long labelCnt)
+    {
+        // pointwise faces are never flipped
+        print("  flipMap List<bool> %llu{0};\n", labelCnt);
+    }
+};
+
+
+/***************************************************************************
+ * Class BcStat represents a single face range with an OpenFOAM boundary
+ * condition.
+ ***************************************************************************/
+class BcStat {
+public:
+    // Default constructor
+    BcStat() :
+        name_(),
+        type_(),
+        nFaces_(0),
+        startFace_(0),
+        myProcNo_(-1),
+        neighbProcNo_(-1)
+    {
+    }
+
+    // Copy constructor, needed to store in value array
+    BcStat(const BcStat& rhs) :
+        name_(rhs.name_),
+        type_(rhs.type_),
+        nFaces_(rhs.nFaces_),
+        startFace_(rhs.startFace_),
+        myProcNo_(rhs.myProcNo_),
+        neighbProcNo_(rhs.neighbProcNo_)
+    {
+    }
+
+    // Destructor
+    ~BcStat()
+    {
+    }
+
+    // Assignment operator
+    BcStat& operator=(const BcStat& rhs)
+    {
+        name_ = rhs.name_;
+        type_ = rhs.type_;
+        nFaces_ = rhs.nFaces_;
+        startFace_ = rhs.startFace_;
+        myProcNo_ = rhs.myProcNo_;
+        neighbProcNo_ = rhs.neighbProcNo_;
+        return *this;
+    }
+
+    // return whether this is a processor patch of a decomposed mesh
+    bool isProcessor() const
+    {
+        return 0 <= neighbProcNo_;
+    }
+
+    std::string name_;      // boundary condition name
+    std::string type_;      // boundary condition type
+    PWP_UINT64  nFaces_;    // number of faces in this range
+    PWP_UINT64  startFace_; // first face number in this range
+    PWP_INT32   myProcNo_;  // processor patch owner, -1 if not processor
+    PWP_INT32   neighbProcNo_; // processor patch neighbour, -1 if not processor
+};
+
+// Value array of BcStat
+typedef std::vector<BcStat> BcStats;
+
+
+/***************************************************************************
+ * Class FoamBoundaryFile is used to write an OpenFOAM "boundary" file.
+ * The boundary file contains the face range to which each boundary
+ * condition is applied.
+ ***************************************************************************/
+class FoamBoundaryFile : public FoamFile {
+public:
+    // Default constructor sets class name and file name
+    FoamBoundaryFile() :
+        FoamFile("polyBoundaryMesh", "boundary", FoamFormat())
+    {
+    }
+
+    // destructor
+    ~FoamBoundaryFile()
+    {
+    }
+
+    /*
+       bndry file contains entries of the form
+
+        <bcName:string>
+        {
+            type <bcPhyType:string>;
+            nFaces <numFacesInBc:integer>;
+            startFace <firstBcFaceIndex:integer>;
+        }
+        ...repeat...
+
+       processor patches of a decomposed mesh also have the entries
+
+            inGroups 1(processor);
+            matchTolerance 0.0001;
+            transform unknown;
+            myProcNo <thisProcessor:integer>;
+            neighbProcNo <otherProcessor:integer>;
+    */
+
+    // write the boundary condition entries
+    void writeBoundaries(const BcStats &bcStats)
+    {
+        BcStats::const_iterator it = bcStats.begin();
+        for (; it != bcStats.end(); ++it) {
+            print("    %s\n", it->name_.c_str());
+            print("    {\n");
+            print("        type %s;\n", it->type_.c_str());
+            print("        nFaces %llu;\n",
+                (unsigned long long)it->nFaces_);
+            print("        startFace %llu;\n",
+                (unsigned long long)it->startFace_);
+            if (it->isProcessor()) {
+                print("        inGroups 1(processor);\n");
+                print("        matchTolerance 0.0001;\n");
+                print("        transform unknown;\n");
+                print("        myProcNo %d;\n", (int)it->myProcNo_);
+                print("        neighbProcNo %d;\n", (int)it->neighbProcNo_);
+            }
+            print("    }\n");
+            incrNumItems();
+        }
+    }
+};
+
+
+/***************************************************************************
+ * Class MeshPartitioner assigns each cell of a PolyMesh to a subdomain.
+ ***************************************************************************/
+class MeshPartitioner {
+
+    enum { MortonBits = 21 };               // Morton key bits per axis
+    enum { MinThreadCells = 64 * 1024 };    // min cells bisected per thread
+    enum { BlockSnapPercent = 10 };         // max imbalance to keep blocks
+
+    // the bounding box and total weight of some cells
+    struct Bounds {
+        float       lo_[3];     // min centroid coords
+        float       hi_[3];     // max centroid coords
+        PWP_UINT64  weight_;    // sum of the cell weights
+    };
+
+    // a subdomain and its share of some cells' weight
+    struct Piece {
+        PWP_UINT32  proc_;      // subdomain
+        PWP_UINT64  weight_;    // relative weight
+    };
+
+    // a cell and its position along the Morton curve
+    struct MortonCell {
+        bool operator<(const MortonCell &rhs) const
+        {
+            return (key_ < rhs.key_) ||
+                ((key_ == rhs.key_) && (cell_ < rhs.cell_));
+        }
+
+        PWP_UINT64  key_;   // interleaved x, y, z bits
+        PWP_UINT32  cell_;  // cell index
+    };
+
+    // the cells being partitioned
+    struct Cells {
+        const float *           xyz_;       // x, y, z of each cell centroid
+        const unsigned char *   weight_;    // weight of each cell
+        PWP_UINT32 *            order_;     // cells in bisection order
+        PWP_UINT32 *            proc_;      // subdomain of each cell
+    };
+
+public:
+    // DecompositionMethod
+    enum Method {
+        Simple,
+        Rcb,
+        Morton,
+        Blocks
+    };
+
+    // Split weighted cells into numProcs subdomains of about equal weight by
+    // recursive coordinate bisection. Each subdomain is bisected across the
+    // longest axis of its centroids' bounding box, with the halves getting
+    // weight in proportion to their number of subdomains. Independent halves
+    // are bisected concurrently.
+    static void partitionRcb(const std::vector<float> &centroids,
+        const std::vector<unsigned char> &weights, PWP_UINT32 numProcs,
+        std::vector<PWP_UINT32> &cellProc)
+    {
+        const PWP_UINT64 numCells = weights.size();
+        cellProc.assign(numCells, 0);
+        if ((numProcs < 2) || (0 == numCells)) {
+            return;
+        }
+        std::vector<PWP_UINT32> order(numCells);
+        for (PWP_UINT64 cell = 0; cell < numCells; ++cell) {
+            order[cell] = (PWP_UINT32)cell;
+        }
+        const Cells cells = { &centroids[0], &weights[0], &order[0],
+            &cellProc[0] };
+        std::vector<Piece> pieces(numProcs);
+        for (PWP_UINT32 proc = 0; proc < numProcs; ++proc) {
+            pieces[proc].proc_ = proc;
+            pieces[proc].weight_ = 1;
+        }
+        bisect(&cells, 0, numCells, &pieces[0], numProcs, numThreads());
+    }
+
+    // return true if a and b differ by at most tol
+    static bool isNear(PWP_UINT64 a, PWP_UINT64 b, PWP_UINT64 tol)
+    {
+        return ((a < b) ? (b - a) : (a - b)) <= tol;
+    }
+
+    // Split weighted cells into numProcs subdomains of about equal weight
+    // along the grid's blocks. The blocks are ordered so that each one
+    // follows a block it shares many faces with, and the weight along that
+    // order is cut into numProcs equal parts. A cut is moved to the nearest
+    // block boundary if that keeps both subdomains beside it within
+    // BlockSnapPercent of the mean weight, so small blocks are grouped
+    // whole. Blocks still cut are split by recursive coordinate bisection.
+    static void partitionBlocks(const PolyMesh &mesh,
+        const std::vector<float> &centroids,
+        const std::vector<unsigned char> &weights,
+        const std::vector<PWP_UINT32> &cellBlock, PWP_UINT32 numProcs,
+        std::vector<PWP_UINT32> &cellProc)
+    {
+        const PWP_UINT64 numCells = weights.size();
+        cellProc.assign(numCells, 0);
+        if ((numProcs < 2) || (0 == numCells)) {
+            return;
+        }
+        // group the cells by block
+        const PWP_UINT32 numBlocks = 1 +
+            *std::max_element(cellBlock.begin(), cellBlock.end());
+        std::vector<PWP_UINT64> blockStart(numBlocks + 1, 0);
+        std::vector<PWP_UINT64> blockWeight(numBlocks, 0);
+        for (PWP_UINT64 cell = 0; cell < numCells; ++cell) {
+            ++blockStart[cellBlock[cell] + 1];
+            blockWeight[cellBlock[cell]] += weights[cell];
+        }
+        for (PWP_UINT32 blk = 0; blk < numBlocks; ++blk) {
+            blockStart[blk + 1] += blockStart[blk];
+        }
+        std::vector<PWP_UINT32> order(numCells);
+        {
+            std::vector<PWP_UINT64> pos(blockStart.begin(),
+                blockStart.end() - 1);
+            for (PWP_UINT64 cell = 0; cell < numCells; ++cell) {
+                order[pos[cellBlock[cell]]++] = (PWP_UINT32)cell;
+            }
+        }
+
+        // count the faces shared by each pair of blocks
+        std::vector<UInt32UInt64Map> shared(numBlocks);
+        const PWP_UINT64 numInternalFaces = mesh.numInternalFaces();
+        for (PWP_UINT64 face = 0; face < numInternalFaces; ++face) {
+            const PWP_UINT32 ownBlk = cellBlock[mesh.owner_[face]];
+            const PWP_UINT32 nbrBlk = cellBlock[mesh.neighbour_[face]];
+            if (ownBlk != nbrBlk) {
+                ++shared[ownBlk][nbrBlk];
+                ++shared[nbrBlk][ownBlk];
+            }
+        }
+
+        // Order the blocks, each one next to the most recently ordered block
+        // it shares faces with
+        std::vector<PWP_UINT32> blocks;
+        blocks.reserve(numBlocks);
+        std::vector<bool> isOrdered(numBlocks, false);
+        for (PWP_UINT32 seed = 0; seed < numBlocks; ++seed) {
+            if (isOrdered[seed] || (0 == blockWeight[seed])) {
+                continue;
+            }
+            PWP_UINT32 next = seed;
+            while (PWP_UINT32_MAX != next) {
+                isOrdered[next] = true;
+                blocks.push_back(next);
+                next = PWP_UINT32_MAX;
+                for (size_t ii = blocks.size(); 0 < ii; --ii) {
+                    PWP_UINT64 maxShared = 0;
+                    const UInt32UInt64Map &nbrs = shared[blocks[ii - 1]];
+                    UInt32UInt64Map::const_iterator it = nbrs.begin();
+                    for (; it != nbrs.end(); ++it) {
+                        if (!isOrdered[it->first] && (maxShared < it->second)) {
+                            maxShared = it->second;
+                            next = it->first;
+                        }
+                    }
+                    if (PWP_UINT32_MAX != next) {
+                        break;
+                    }
+                }
+            }
+        }
+
+        // cut the ordered weight into numProcs parts
+        PWP_UINT64 totalWeight = 0;
+        for (size_t ii = 0; ii < blocks.size(); ++ii) {
+            totalWeight += blockWeight[blocks[ii]];
+        }
+        const PWP_UINT64 snap = (totalWeight * BlockSnapPercent) /
+            (100 * (PWP_UINT64)numProcs);
+        std::vector<PWP_UINT64> cuts(numProcs + 1, totalWeight);
+        cuts[0] = 0;
+        size_t blkNdx = 0;
+        PWP_UINT64 blkEnd = blockWeight[blocks[0]];
+        PWP_UINT64 prevCut = 0;
+        for (PWP_UINT32 proc = 1; proc < numProcs; ++proc) {
+            const PWP_UINT64 cut = (totalWeight * proc) / numProcs;
+            while (blkEnd < cut) {
+                blkEnd += blockWeight[blocks[++blkNdx]];
+            }
+            const PWP_UINT64 blkBegin = blkEnd - blockWeight[blocks[blkNdx]];
+            // A snapped cut must keep the subdomain it closes within snap of
+            // its equal share. The next subdomain is closed by a cut that is
+            // either checked the same way or left on its equal share, so
+            // every subdomain stays within snap.
+            const PWP_UINT64 share = cut - prevCut;
+            if ((cuts[proc - 1] < blkBegin) && (cut - blkBegin <= snap) &&
+                    (cut - blkBegin <= blkEnd - cut) &&
+                    isNear(blkBegin - cuts[proc - 1], share, snap)) {
+                cuts[proc] = blkBegin;
+            }
+            else if ((blkEnd - cut <= snap) &&
+                    isNear(blkEnd - cuts[proc - 1], share, snap)) {
+                cuts[proc] = blkEnd;
+            }
+            else {
+                cuts[proc] = cut;
+            }
+            prevCut = cut;
+        }
+
+        // split each block among the subdomains its weight overlaps
+        const Cells cells = { &centroids[0], &weights[0], &order[0],
+            &cellProc[0] };
+        std::vector<Piece> pieces;
+        PWP_UINT32 proc = 0;
+        PWP_UINT64 blkBegin = 0;
+        for (size_t ii = 0; ii < blocks.size(); ++ii) {
+            const PWP_UINT32 blk = blocks[ii];
+            const PWP_UINT64 blkEnd = blkBegin + blockWeight[blk];
+            pieces.clear();
+            while (true) {
+                const PWP_UINT64 begin = std::max(blkBegin, cuts[proc]);
+                const PWP_UINT64 end = std::min(blkEnd, cuts[proc + 1]);
+                if (begin < end) {
+                    Piece piece;
+                    piece.proc_ = proc;
+                    piece.weight_ = end - begin;
+                    pieces.push_back(piece);
+                }
+                if ((cuts[proc + 1] > blkEnd) || (proc + 1 == numProcs)) {
+                    break;
+                }
+                ++proc;
+            }
+            bisect(&cells, blockStart[blk], blockStart[blk + 1], &pieces[0],
+                (PWP_UINT32)pieces.size(), numThreads());
+            blkBegin = blkEnd;
+        }
+    }
+
+    // Split weighted cells into numProcs subdomains of about equal weight
+    // along the Morton (Z-order) curve through their centroids. The curve
+    // keys are computed and sorted concurrently.
+    static void partitionMorton(const std::vector<float> &centroids,
+        const std::vector<unsigned char> &weights, PWP_UINT32 numProcs,
+        std::vector<PWP_UINT32> &cellProc)
+    {
+        const PWP_UINT64 numCells = weights.size();
+        cellProc.assign(numCells, 0);
+        if ((numProcs < 2) || (0 == numCells)) {
+            return;
+        }
+        std::vector<PWP_UINT32> curve;
+        mortonOrder(&centroids[0], numCells, curve);
+        PWP_UINT64 totalWeight = 0;
+        for (PWP_UINT64 cell = 0; cell < numCells; ++cell) {
+            totalWeight += weights[cell];
+        }
+
+        // assign each cell by the weight before its middle along the curve
+        PWP_UINT64 weight = 0;
+        for (PWP_UINT64 ii = 0; ii < numCells; ++ii) {
+            const PWP_UINT32 cell = curve[ii];
+            const PWP_UINT64 w = weights[cell];
+            cellProc[cell] = (PWP_UINT32)std::min((PWP_UINT64)(numProcs - 1),
+                ((2 * weight + w) * numProcs) / (2 * totalWeight));
+            weight += w;
+        }
+    }
+
+    // Get the order of num points, stored as x, y, z triples, along the
+    // Morton (Z-order) curve through their bounding box. The curve keys are
+    // computed and sorted concurrently.
+    static void mortonOrder(const float *xyz, PWP_UINT64 num,
+        std::vector<PWP_UINT32> &order)
+    {
+        order.clear();
+        if (0 == num) {
+            return;
+        }
+        const Cells cells = { xyz, 0, 0, 0 };
+        BoundsBody boundsBody(cells, num);
+        ParallelFor::run(num, boundsBody);
+        const Bounds box = boundsBody.result();
+
+        std::vector<MortonCell> curve(num);
+        MortonKeyBody keyBody(cells, box, curve);
+        ParallelFor::run(num, keyBody);
+        SortBody sortBody(curve);
+        ParallelFor::run(num, sortBody);
+        const PWP_UINT32 numRanges = ParallelFor::numRanges(num);
+        for (PWP_UINT32 width = 1; width < numRanges; width *= 2) {
+            MergeBody mergeBody(curve, numRanges, width);
+            ParallelFor::run((numRanges + 2 * width - 1) / (2 * width),
+                mergeBody, 1);
+        }
+        order.resize(num);
+        for (PWP_UINT64 ii = 0; ii < num; ++ii) {
+            order[ii] = curve[ii].cell_;
+        }
+    }
+
+    // Split the cells into numProcs slabs of equal cell count along the
+    // longest axis of the centroids' bounding box. This matches the
+    // decomposePar "simple" method with a single split direction.
+    static void partition(const std::vector<float> &centroids,
+        PWP_UINT32 numProcs, std::vector<PWP_UINT32> &cellProc)
+    {
+        const PWP_UINT64 numCells = centroids.size() / 3;
+        cellProc.assign(numCells, 0);
+        if ((numProcs < 2) || (0 == numCells)) {
+            return;
+        }
+        const Cells cells = { &centroids[0], 0, 0, 0 };
+        BoundsBody boundsBody(cells, numCells);
+        ParallelFor::run(numCells, boundsBody);
+        const Bounds box = boundsBody.result();
+        int axis = 0;
+        for (int ii = 1; ii < 3; ++ii) {
+            if ((box.hi_[ii] - box.lo_[ii]) >
+                    (box.hi_[axis] - box.lo_[axis])) {
+                axis = ii;
+            }
+        }
+        std::vector<PWP_UINT64> order(numCells);
+        for (PWP_UINT64 cell = 0; cell < numCells; ++cell) {
+            order[cell] = cell;
+        }
+        std::stable_sort(order.begin(), order.end(),
+            CoordLess(centroids, axis));
+        for (PWP_UINT64 ii = 0; ii < numCells; ++ii) {
+            cellProc[order[ii]] = (PWP_UINT32)((ii * numProcs) / numCells);
+        }
+    }
+
+private:
+    // num threads used to bisect cells
+    static PWP_UINT32 numThreads()
+    {
+#if defined(HAVE_STD_THREAD)
+        return std::max((PWP_UINT32)std::thread::hardware_concurrency(),
+            (PWP_UINT32)1);
+#else
+        return 1;
+#endif /* HAVE_STD_THREAD */
+    }
+
+    // get the bounding box and weight of cells order_[first, last), or of
+    // cells [first, last) if order_ is null. The weight is 0 if weight_ is
+    // null.
+    static Bounds bounds(const Cells &cells, PWP_UINT64 first,
+        PWP_UINT64 last)
+    {
+        Bounds ret;
+        for (int ii = 0; ii < 3; ++ii) {
+            ret.lo_[ii] = std::numeric_limits<float>::max();
+            ret.hi_[ii] = -std::numeric_limits<float>::max();
+        }
+        ret.weight_ = 0;
+        for (PWP_UINT64 jj = first; jj < last; ++jj) {
+            const PWP_UINT32 cell = cells.order_ ? cells.order_[jj] :
+                (PWP_UINT32)jj;
+            const float *xyz = &cells.xyz_[3 * (PWP_UINT64)cell];
+            for (int ii = 0; ii < 3; ++ii) {
+                ret.lo_[ii] = std::min(ret.lo_[ii], xyz[ii]);
+                ret.hi_[ii] = std::max(ret.hi_[ii], xyz[ii]);
+            }
+            if (0 != cells.weight_) {
+                ret.weight_ += cells.weight_[cell];
+            }
+        }
+        return ret;
+    }
+
+    // Assign cells order_[first, last) to the subdomains of numPieces
+    // pieces, sharing the cells' weight in proportion to the pieces' weights
+    static void bisect(const Cells *cells, PWP_UINT64 first, PWP_UINT64 last,
+        const Piece *pieces, PWP_UINT32 numPieces, PWP_UINT32 numThreads)
+    {
+        if (1 == numPieces) {
+            for (PWP_UINT64 ii = first; ii < last; ++ii) {
+                cells->proc_[cells->order_[ii]] = pieces[0].proc_;
+            }
+            return;
+        }
+        const Bounds box = bounds(*cells, first, last);
+        int axis = 0;
+        for (int ii = 1; ii < 3; ++ii) {
+            if ((box.hi_[ii] - box.lo_[ii]) > (box.hi_[axis] - box.lo_[axis])) {
+                axis = ii;
+            }
+        }
+        const PWP_UINT32 numLow = numPieces / 2;
+        PWP_UINT64 lowWeight = 0;
+        PWP_UINT64 weight = 0;
+        for (PWP_UINT32 ii = 0; ii < numPieces; ++ii) {
+            lowWeight += (ii < numLow) ? pieces[ii].weight_ : 0;
+            weight += pieces[ii].weight_;
+        }
+        const PWP_UINT64 mid = split(*cells, first, last, axis,
+            (box.weight_ * lowWeight) / std::max(weight, (PWP_UINT64)1));
+#if defined(HAVE_STD_THREAD)
+        if ((1 < numThreads) && (MinThreadCells <= (last - first))) {
+            const PWP_UINT32 lowThreads = numThreads / 2;
+            std::thread low(bisect, cells, first, mid, pieces, numLow,
+                lowThreads);
+            bisect(cells, mid, last, pieces + numLow, numPieces - numLow,
+                numThreads - lowThreads);
+            low.join();
+            return;
+        }
+#endif /* HAVE_STD_THREAD */
+        bisect(cells, first, mid, pieces, numLow, 1);
+        bisect(cells, mid, last, pieces + numLow, numPieces - numLow, 1);
+    }
+
+    // Reorder cells order_[first, last) so the cells before the returned
+    // position weigh about target and none of them lies above a cell after
+    // it along axis. This is a weighted quickselect.
+    static PWP_UINT64 split(const Cells &cells, PWP_UINT64 first,
+        PWP_UINT64 last, int axis, PWP_UINT64 target)
+    {
+        PWP_UINT32 *order = cells.order_;
+        while (first < last) {
+            // median of three pivot
+            const float a = cells.xyz_[3 * (PWP_UINT64)order[first] + axis];
+            const float b = cells.xyz_[3 *
+                (PWP_UINT64)order[first + (last - first) / 2] + axis];
+            const float c = cells.xyz_[3 * (PWP_UINT64)order[last - 1] + axis];
+            const float pivot = std::max(std::min(a, b),
+                std::min(std::max(a, b), c));
+            // three way partition into below, equal to and above the pivot
+            PWP_UINT32 *lo = std::partition(order + first, order + last,
+                CoordBelow(cells.xyz_, axis, pivot, false));
+            PWP_UINT32 *hi = std::partition(lo, order + last,
+                CoordBelow(cells.xyz_, axis, pivot, true));
+            PWP_UINT64 weight = 0;
+            for (PWP_UINT32 *it = order + first; it != lo; ++it) {
+                weight += cells.weight_[*it];
+            }
+            if (target < weight) {
+                last = lo - order;
+                continue;
+            }
+            target -= weight;
+            weight = 0;
+            for (PWP_UINT32 *it = lo; it != hi; ++it) {
+                weight += cells.weight_[*it];
+            }
+            if (target < weight) {
+                // split the cells equal to the pivot nearest to target
+                PWP_UINT64 pos = lo - order;
+                const PWP_UINT64 end = hi - order;
+                weight = 0;
+                while (pos < end) {
+                    const PWP_UINT64 w = cells.weight_[order[pos]];
+                    if (2 * target < 2 * weight + w) {
+                        break;
+                    }
+                    weight += w;
+                    ++pos;
+                }
+                return pos;
+            }
+            target -= weight;
+            first = hi - order;
+        }
+        return first;
+    }
+
+    // selects cells below a pivot along an axis, or not above it if orEqual
+    struct CoordBelow {
+        CoordBelow(const float *xyz, int axis, float pivot, bool orEqual) :
+            xyz_(xyz),
+            axis_(axis),
+            pivot_(pivot),
+            orEqual_(orEqual)
+        {
+        }
+
+        bool operator()(PWP_UINT32 cell) const
+        {
+            const float v = xyz_[3 * (PWP_UINT64)cell + axis_];
+            return orEqual_ ? !(pivot_ < v) : (v < pivot_);
+        }
+
+        const float *xyz_;
+        int         axis_;
+        float       pivot_;
+        bool        orEqual_;
+    };
+
+    // ParallelFor body computing the bounds of each range of cells
+    struct BoundsBody {
+        BoundsBody(const Cells &cells, PWP_UINT64 numCells) :
+            cells_(cells),
+            ranges_(ParallelFor::numRanges(numCells))
+        {
+        }
+
+        void operator()(PWP_UINT32 range, PWP_UINT64 begin, PWP_UINT64 end)
+        {
+            ranges_[range] = bounds(cells_, begin, end);
+        }
+
+        // get the bounds of all ranges
+        Bounds result() const
+        {
+            Bounds ret = ranges_[0];
+            for (size_t jj = 1; jj < ranges_.size(); ++jj) {
+                for (int ii = 0; ii < 3; ++ii) {
+                    ret.lo_[ii] = std::min(ret.lo_[ii], ranges_[jj].lo_[ii]);
+                    ret.hi_[ii] = std::max(ret.hi_[ii], ranges_[jj].hi_[ii]);
+                }
+                ret.weight_ += ranges_[jj].weight_;
+            }
+            return ret;
+        }
+
+        const Cells &       cells_;
+        std::vector<Bounds> ranges_;
+    };
+
+    // ParallelFor body computing the Morton key of each cell
+    struct MortonKeyBody {
+        MortonKeyBody(const Cells &cells, const Bounds &box,
+                std::vector<MortonCell> &curve) :
+            cells_(cells),
+            box_(box),
+            curve_(curve)
+        {
+            const float maxKey = (float)((1 << MortonBits) - 1);
+            for (int ii = 0; ii < 3; ++ii) {
+                const float len = box.hi_[ii] - box.lo_[ii];
+                scale_[ii] = (0.0f < len) ? (maxKey / len) : 0.0f;
+            }
+        }
+
+        void operator()(PWP_UINT32, PWP_UINT64 begin, PWP_UINT64 end)
+        {
+            const float maxKey = (float)((1 << MortonBits) - 1);
+            for (PWP_UINT64 cell = begin; cell < end; ++cell) {
+                const float *xyz = &cells_.xyz_[3 * cell];
+                PWP_UINT64 key = 0;
+                for (int ii = 0; ii < 3; ++ii) {
+                    const float q = std::min(maxKey,
+                        (xyz[ii] - box_.lo_[ii]) * scale_[ii]);
+                    key |= spreadBits((PWP_UINT64)std::max(q, 0.0f)) << ii;
+                }
+                curve_[cell].key_ = key;
+                curve_[cell].cell_ = (PWP_UINT32)cell;
+            }
+        }
+
+        // insert two zero bits above each of the low MortonBits bits of v
+        static PWP_UINT64 spreadBits(PWP_UINT64 v)
+        {
+            v &= 0x1FFFFFULL;
+            v = (v | (v << 32)) & 0x1F00000000FFFFULL;
+            v = (v | (v << 16)) & 0x1F0000FF0000FFULL;
+            v = (v | (v << 8)) & 0x100F00F00F00F00FULL;
+            v = (v | (v << 4)) & 0x10C30C30C30C30C3ULL;
+            v = (v | (v << 2)) & 0x1249249249249249ULL;
+            return v;
+        }
+
+        const Cells &               cells_;
+        Bounds                      box_;
+        float                       scale_[3];
+        std::vector<MortonCell> &   curve_;
+    };
+
+    // ParallelFor body sorting each range of the curve
+    struct SortBody {
+        SortBody(std::vector<MortonCell> &curve) :
+            curve_(curve)
+        {
+        }
+
+        void operator()(PWP_UINT32, PWP_UINT64 begin, PWP_UINT64 end)
+        {
+            std::sort(curve_.begin() + begin, curve_.begin() + end);
+        }
+
+        std::vector<MortonCell> &curve_;
+    };
+
+    // ParallelFor body merging pairs of sorted runs of width ranges each
+    struct MergeBody {
+        MergeBody(std::vector<MortonCell> &curve, PWP_UINT32 numRanges,
+                PWP_UINT32 width) :
+            curve_(curve),
+            numRanges_(numRanges),
+            width_(width)
+        {
+        }
+
+        void operator()(PWP_UINT32, PWP_UINT64 begin, PWP_UINT64 end)
+        {
+            const PWP_UINT64 size = curve_.size();
+            for (PWP_UINT64 pair = begin; pair < end; ++pair) {
+                const PWP_UINT32 lo = (PWP_UINT32)(2 * width_ * pair);
+                const PWP_UINT32 mid = std::min(lo + width_, numRanges_);
+                const PWP_UINT32 hi = std::min(mid + width_, numRanges_);
+                if (mid < hi) {
+                    std::inplace_merge(
+                        curve_.begin() + ParallelFor::rangeBegin(size,
+                            numRanges_, lo),
+                        curve_.begin() + ParallelFor::rangeBegin(size,
+                            numRanges_, mid),
+                        curve_.begin() + ParallelFor::rangeBegin(size,
+                            numRanges_, hi));
+                }
+            }
+        }
+
+        std::vector<MortonCell> &   curve_;
+        PWP_UINT32                  numRanges_;
+        PWP_UINT32                  width_;
+    };
+
+    // orders cells by one coordinate of their centroids
+    struct CoordLess {
+        CoordLess(const std::vector<float> &centres, int axis) :
+            centres_(centres),
+            axis_(axis)
+        {
+        }
+
+        bool operator()(PWP_UINT64 a, PWP_UINT64 b) const
+        {
+            return centres_[3 * a + axis_] < centres_[3 * b + axis_];
+        }
+
+        const std::vector<float> &centres_;
+        int axis_;
+    };
+};
+
+
+/***************************************************************************
+ * Class MeshOrdering maps the cells and faces of the face stream to their
+ * exported indices. Both keep their streamed order unless renumbered.
+ *
+ * Cells may be renumbered by reverse Cuthill-McKee to reduce the bandwidth
+ * of the owner/neighbour matrix. The internal faces are then sorted by owner
+ * and neighbour to keep OpenFOAM's upper triangular face order.
+ *
+ * The streamed internal faces may also be checked for upper triangular
+ * order and, if needed, sorted without renumbering the cells.
+ ***************************************************************************/
+class MeshOrdering {
+public:
+    // Default constructor
+    MeshOrdering() :
+        cellNew_(),
+        faceNew_(),
+        owner_(),
+        neighbour_()
+    {
+    }
+
+    // destructor
+    ~MeshOrdering()
+    {
+    }
+
+    // return true if any cell or face is not exported in streamed order
+    bool isReordered() const
+    {
+        return !cellNew_.empty() || !faceNew_.empty();
+    }
+
+    // get the exported index of a streamed cell
+    PWP_UINT32 cell(PWP_UINT32 cell) const
+    {
+        return cellNew_.empty() ? cell : cellNew_[cell];
+    }
+
+    // get the exported index of a streamed face
+    PWP_UINT64 face(PWP_UINT64 face) const
+    {
+        return (face < faceNew_.size()) ? faceNew_[face] : face;
+    }
+
+    // record the cells of a streamed internal face for renumberCells()
+    void addInternalFace(PWP_UINT32 face, PWP_UINT32 owner,
+        PWP_UINT32 neighbour)
+    {
+        if (face >= owner_.size()) {
+            owner_.resize(face + 1, 0);
+            neighbour_.resize(face + 1, 0);
+        }
+        owner_[face] = owner;
+        neighbour_[face] = neighbour;
+    }
+
+    // Renumber the cells in reverse Cuthill-McKee order. Each connected
+    // group of cells is numbered breadth first from a cell far from its
+    // lowest numbered cell, taking each cell's unnumbered neighbours by
+    // increasing number of neighbours. The internal faces are then sorted
+    // by their lower and higher cell.
+    void renumberCells(PWP_UINT32 numCells)
+    {
+        const PWP_UINT64 numFaces = owner_.size();
+
+        // the neighbour cells of each cell in compressed rows
+        std::vector<PWP_UINT64> start(numCells + 1, 0);
+        for (PWP_UINT64 face = 0; face < numFaces; ++face) {
+            ++start[owner_[face] + 1];
+            ++start[neighbour_[face] + 1];
+        }
+        for (PWP_UINT32 cell = 0; cell < numCells; ++cell) {
+            start[cell + 1] += start[cell];
+        }
+        std::vector<PWP_UINT32> adj(start[numCells]);
+        {
+            std::vector<PWP_UINT64> pos(start.begin(), start.end() - 1);
+            for (PWP_UINT64 face = 0; face < numFaces; ++face) {
+                adj[pos[owner_[face]]++] = neighbour_[face];
+                adj[pos[neighbour_[face]]++] = owner_[face];
+            }
+        }
+
+        std::vector<PWP_UINT32> order;
+        order.reserve(numCells);
+        {
+            std::vector<bool> isNumbered(numCells, false);
+            std::vector<PWP_UINT32> mark(numCells, PWP_UINT32_MAX);
+            std::vector<PWP_UINT32> queue;
+            const DegreeLess degreeLess(start);
+            for (PWP_UINT32 seed = 0; seed < numCells; ++seed) {
+                if (isNumbered[seed]) {
+                    continue;
+                }
+                size_t head = order.size();
+                const PWP_UINT32 root = peripheralCell(seed, start, adj, mark,
+                    queue);
+                isNumbered[root] = true;
+                order.push_back(root);
+                for (; head < order.size(); ++head) {
+                    const size_t first = order.size();
+                    const PWP_UINT32 cell = order[head];
+                    for (PWP_UINT64 ii = start[cell]; ii < start[cell + 1];
+                            ++ii) {
+                        if (!isNumbered[adj[ii]]) {
+                            isNumbered[adj[ii]] = true;
+                            order.push_back(adj[ii]);
+                        }
+                    }
+                    std::stable_sort(order.begin() + first, order.end(),
+                        degreeLess);
+                }
+            }
+        }
+        cellNew_.resize(numCells);
+        for (PWP_UINT32 ii = 0; ii < numCells; ++ii) {
+            cellNew_[order[ii]] = numCells - 1 - ii;
+        }
+        std::vector<PWP_UINT32>().swap(order);
+        std::vector<PWP_UINT32>().swap(adj);
+        std::vector<PWP_UINT64>().swap(start);
+        sortFaces(numCells);
+    }
+
+    // Count the recorded internal faces that break the upper triangular
+    // order. numFlipped gets the faces owned by their higher cell and
+    // numUnsorted the faces whose lower and higher cells sort below those
+    // of the face before them. The faces are checked concurrently.
+    void checkFaceOrder(PWP_UINT64 &numFlipped, PWP_UINT64 &numUnsorted) const
+    {
+        FaceCheckBody body(*this);
+        ParallelFor::run(owner_.size(), body);
+        numFlipped = body.numFlipped();
+        numUnsorted = body.numUnsorted();
+    }
+
+    // Sort the recorded internal faces by their lower cell, then by their
+    // higher cell, and release them. The faces are bucketed by lower cell
+    // and the buckets are sorted concurrently.
+    void sortFaces(PWP_UINT32 numCells)
+    {
+        const PWP_UINT64 numFaces = owner_.size();
+        std::vector<PWP_UINT64> start(numCells + 1, 0);
+        for (PWP_UINT64 face = 0; face < numFaces; ++face) {
+            ++start[lowerCell(face) + 1];
+        }
+        for (PWP_UINT32 cell = 0; cell < numCells; ++cell) {
+            start[cell + 1] += start[cell];
+        }
+        std::vector<PWP_UINT32> faces(numFaces);
+        {
+            std::vector<PWP_UINT64> pos(start.begin(), start.end() - 1);
+            for (PWP_UINT64 face = 0; face < numFaces; ++face) {
+                faces[pos[lowerCell(face)]++] = (PWP_UINT32)face;
+            }
+        }
+        BucketSortBody sortBody(*this, start, faces);
+        ParallelFor::run(numCells, sortBody);
+        if (faceNew_.size() < numFaces) {
+            faceNew_.resize(numFaces);
+        }
+        for (PWP_UINT64 ii = 0; ii < numFaces; ++ii) {
+            faceNew_[faces[ii]] = (PWP_UINT32)ii;
+        }
+        clearInternalFaces();
+    }
+
+    // release the recorded internal faces
+    void clearInternalFaces()
+    {
+        std::vector<PWP_UINT32>().swap(owner_);
+        std::vector<PWP_UINT32>().swap(neighbour_);
+    }
+
+    // Sort the faces of a boundary patch along the Morton curve through
+    // their centroids. The patch streams from face first and centroids
+    // holds the x, y, z of each of its faces in streamed order.
+    void sortPatch(PWP_UINT64 first, const std::vector<float> &centroids)
+    {
+        const PWP_UINT64 numFaces = centroids.size() / 3;
+        if (0 == numFaces) {
+            return;
+        }
+        std::vector<PWP_UINT32> order;
+        MeshPartitioner::mortonOrder(&centroids[0], numFaces, order);
+        for (PWP_UINT64 face = faceNew_.size(); face < first; ++face) {
+            faceNew_.push_back((PWP_UINT32)face);
+        }
+        faceNew_.resize(first + numFaces);
+        for (PWP_UINT64 ii = 0; ii < numFaces; ++ii) {
+            faceNew_[first + order[ii]] = (PWP_UINT32)(first + ii);
+        }
+    }
+
+private:
+    // get the renumbered lower cell of a recorded internal face
+    PWP_UINT32 lowerCell(PWP_UINT64 face) const
+    {
+        return std::min(cell(owner_[face]), cell(neighbour_[face]));
+    }
+
+    // get the renumbered higher cell of a recorded internal face
+    PWP_UINT32 higherCell(PWP_UINT64 face) const
+    {
+        return std::max(cell(owner_[face]), cell(neighbour_[face]));
+    }
+
+    // Get a cell far from seed, the cell with the fewest neighbours in the
+    // last breadth first level from seed. Cells reached are marked with
+    // seed.
+    static PWP_UINT32 peripheralCell(PWP_UINT32 seed,
+        const std::vector<PWP_UINT64> &start,
+        const std::vector<PWP_UINT32> &adj, std::vector<PWP_UINT32> &mark,
+        std::vector<PWP_UINT32> &queue)
+    {
+        queue.clear();
+        queue.push_back(seed);
+        mark[seed] = seed;
+        size_t levelBegin = 0;
+        size_t head = 0;
+        while (head < queue.size()) {
+            levelBegin = head;
+            const size_t levelEnd = queue.size();
+            for (; head < levelEnd; ++head) {
+                const PWP_UINT32 cell = queue[head];
+                for (PWP_UINT64 ii = start[cell]; ii < start[cell + 1]; ++ii) {
+                    if (seed != mark[adj[ii]]) {
+                        mark[adj[ii]] = seed;
+                        queue.push_back(adj[ii]);
+                    }
+                }
+            }
+        }
+        return *std::min_element(queue.begin() + levelBegin, queue.end(),
+            DegreeLess(start));
+    }
+
+    // orders cells by their number of neighbours
+    struct DegreeLess {
+        DegreeLess(const std::vector<PWP_UINT64> &start) :
+            start_(start)
+        {
+        }
+
+        bool operator()(PWP_UINT32 a, PWP_UINT32 b) const
+        {
+            return (start_[a + 1] - start_[a]) < (start_[b + 1] - start_[b]);
+        }
+
+        const std::vector<PWP_UINT64> &start_;
+    };
+
+    // orders recorded internal faces by their renumbered higher cell
+    struct HigherCellLess {
+        HigherCellLess(const MeshOrdering &ordering) :
+            ordering_(ordering)
+        {
+        }
+
+        bool operator()(PWP_UINT32 a, PWP_UINT32 b) const
+        {
+            return ordering_.higherCell(a) < ordering_.higherCell(b);
+        }
+
+        const MeshOrdering &ordering_;
+    };
+
+    // ParallelFor body sorting the faces of each lower cell bucket by
+    // higher cell
+    struct BucketSortBody {
+        BucketSortBody(const MeshOrdering &ordering,
+                const std::vector<PWP_UINT64> &start,
+                std::vector<PWP_UINT32> &faces) :
+            less_(ordering),
+            start_(start),
+            faces_(faces)
+        {
+        }
+
+        void operator()(PWP_UINT32, PWP_UINT64 begin, PWP_UINT64 end)
+        {
+            for (PWP_UINT64 cell = begin; cell < end; ++cell) {
+                std::sort(faces_.begin() + start_[cell],
+                    faces_.begin() + start_[cell + 1], less_);
+            }
+        }
+
+        const HigherCellLess            less_;
+        const std::vector<PWP_UINT64> & start_;
+        std::vector<PWP_UINT32> &       faces_;
+    };
+
+    // ParallelFor body counting the faces that break the upper triangular
+    // order
+    struct FaceCheckBody {
+        FaceCheckBody(const MeshOrdering &ordering) :
+            ordering_(ordering),
+            flipped_(ParallelFor::numRanges(ordering.owner_.size()), 0),
+            unsorted_(flipped_.size(), 0)
+        {
+        }
+
+        void operator()(PWP_UINT32 range, PWP_UINT64 begin, PWP_UINT64 end)
+        {
+            const MeshOrdering &o = ordering_;
+            for (PWP_UINT64 face = begin; face < end; ++face) {
+                if (o.cell(o.owner_[face]) > o.cell(o.neighbour_[face])) {
+                    ++flipped_[range];
+                }
+                if ((0 < face) && ((o.lowerCell(face) < o.lowerCell(face - 1))
+                        || ((o.lowerCell(face) == o.lowerCell(face - 1)) &&
+                        (o.higherCell(face) < o.higherCell(face - 1))))) {
+                    ++unsorted_[range];
+                }
+            }
+        }
+
+        // get the number of faces owned by their higher cell
+        PWP_UINT64 numFlipped() const
+        {
+            return std::accumulate(flipped_.begin(), flipped_.end(),
+                (PWP_UINT64)0);
+        }
+
+        // get the number of faces out of order
+        PWP_UINT64 numUnsorted() const
+        {
+            return std::accumulate(unsorted_.begin(), unsorted_.end(),
+                (PWP_UINT64)0);
+        }
+
+        const MeshOrdering &    ordering_;
+        std::vector<PWP_UINT64> flipped_;
+        std::vector<PWP_UINT64> unsorted_;
+    };
+
+    std::vector<PWP_UINT32> cellNew_;   // exported index of each cell
+    std::vector<PWP_UINT32> faceNew_;   // exported index of leading faces
+    std::vector<PWP_UINT32> owner_;     // streamed owner of internal faces
+    std::vector<PWP_UINT32> neighbour_; // streamed neighbour of internal faces
+};
 
 
 /***************************************************************************
- * Base Class FoamZoneFile is used to write various OpenFOAM "zone" files.
- * A zone file contains sets of faces or cells with various attributes.
- * Zone files are used to defined volume and boundary conditions.
+ * Class FaceReorderBuffer holds faces that arrive before the faces exported
+ * ahead of them, and releases them in exported order. Only the faces from
+ * the next face to export up to the furthest face that arrived are held.
+ *
+ * This is not bounded. Renumbered cells scatter the faces of the stream's
+ * first cells across the whole export order, so the buffer can hold most
+ * internal faces at sizeof(Face), about 56 bytes, each. The peak is kept
+ * so it can be reported.
  ***************************************************************************/
-class FoamZoneFile : public FoamFile {
+class FaceReorderBuffer {
 public:
-    // Constructor sets class to "regIOobject" and location to polyMesh
-    // directory
-    FoamZoneFile(const char *object) :
-        FoamFile("regIOobject", object, "constant/polyMesh")
+    static const PWP_UINT32 NoNeighbour = PWP_UINT32_MAX; // boundary face
+
+    // a face, its owner and its neighbour
+    struct Face {
+        Face() :
+            cnt_(0),
+            owner_(0),
+            neighbour_(NoNeighbour),
+            hasArrived_(false)
+        {
+        }
+
+        // reverse the face's normal, keeping its first vertex
+        void flip()
+        {
+            std::reverse(ndx_ + 1, ndx_ + std::max(cnt_, (PWP_UINT32)1));
+        }
+
+        PWP_UINT64  ndx_[4];        // OpenFOAM ordered vertex indices
+        PWP_UINT32  cnt_;           // num vertices in ndx_
+        PWP_UINT32  owner_;         // owner cell
+        PWP_UINT32  neighbour_;     // neighbour cell of internal faces
+        bool        hasArrived_;    // false if a placeholder
+    };
+
+    // Default constructor
+    FaceReorderBuffer() :
+        next_(0),
+        peak_(0),
+        faces_()
     {
     }
 
     // destructor
-    virtual ~FoamZoneFile()
+    ~FaceReorderBuffer()
     {
     }
 
-    // write the address section of the set file with the given name to the
-    // zone file
-    bool writeSet(const std::string &setName)
+    // add the face exported at index pos, return false if pos was already
+    // released
+    bool push(PWP_UINT64 pos, const Face &face)
     {
-        // Parsing logic assumes a set file of format:
-        //
-        // FoamFile
-        // {
-        //     version     2.0;
-        //     format      ascii;
-        //     location    "constant/polyMesh/sets";
-        //     class       cellSet;
-        //     object      blade;
-        // }
-        //
-        // // * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * //
-        //
-        // 4807  <-- start writing here
-        // (
-        //  9947  9948  9949  9950  9951  9952  9953  9954  9955  9956
-        //  9957  9958  9959  9960  9961  9962  9963  9964  9965  9966
-        //  ...
-        // 14737 14738 14739 14740 14741 14742 14743 14744 14745 14746
-        // 14747 14748 14749 14750 14751 14752 14753 )  <-- end writing here
+        if (pos < next_) {
+            return false;
+        }
+        const PWP_UINT64 slot = pos - next_;
+        if (slot >= faces_.size()) {
+            faces_.resize((size_t)slot + 1);
+        }
+        faces_[(size_t)slot] = face;
+        faces_[(size_t)slot].hasArrived_ = true;
+        peak_ = std::max(peak_, (PWP_UINT64)faces_.size());
+        return true;
+    }
 
-        bool ret = false;
-        if (0 != getNumItems()) {
-            fprintf(*this, "\n");
+    // get the next face to export if it has arrived
+    bool pop(Face &face)
+    {
+        if (faces_.empty() || !faces_.front().hasArrived_) {
+            return false;
         }
+        face = faces_.front();
+        faces_.pop_front();
+        ++next_;
+        return true;
+    }
 
-        fprintf(*this, "%s\n", setName.c_str());
-        pwpFileWriteStr("{\n", *this);
-        // allow subclass to write custom data before label list
-        this->writeLabelListPrefix();
-        std::string setFileName("sets/");
-        setFileName += setName;
-        FILE *setFile = pwpFileOpen(setFileName.c_str(), pwpRead | pwpAscii);
-        unsigned long labelCnt = 0;
+    // return true if no face is held
+    bool empty() const
+    {
+        return faces_.empty();
+    }
 
-        if (0 != setFile) {
-            ret = true;
-            // search setFile until we find a line starting with a digit char
-            char buf[1024];
-            fgets(buf, sizeof(buf), setFile);
-            while (!pwpFileEof(setFile)) {
-                // sscanf handles possible leading/trailing whitespace
-                if (1 == sscanf(buf, " %lu \n", &labelCnt)) {
-                    break;
+    // get the most faces held at once, placeholders included
+    PWP_UINT64 peak() const
+    {
+        return peak_;
+    }
+
+    // get the most bytes held at once
+    PWP_UINT64 peakBytes() const
+    {
+        return peak_ * sizeof(Face);
+    }
+
+private:
+    PWP_UINT64          next_;  // exported index of the next face to release
+    PWP_UINT64          peak_;  // most faces held at once
+    std::deque<Face>    faces_; // faces from next_ on
+};
+
+
+/***************************************************************************
+ * Class MeshQuality measures the cells and faces of the mesh as checkMesh
+ * would, from two face streams. The first sums the volume, centre and
+ * closed area of each cell from its faces. The second measures the
+ * non-orthogonality and skewness of each face from its cells' centres.
+ *
+ * Streamed faces are gathered into chunks of x, y, z arrays and each chunk
+ * is measured concurrently, one range of FacesPerThread faces per thread.
+ * Threads are started for every chunk, so each gets some 6 MB of faces to
+ * outweigh its start. The loops are not vectorized by default: each face
+ * takes square roots and an arc cosine, which are math library calls
+ * unless errno is disabled, and reads its cells by index.
+ *
+ * The first stream holds a CellSum, 56 bytes, and a started bit per cell.
+ * endCells() reduces them to the cell centres, 24 bytes per cell, which the
+ * second stream holds. Doubles are kept so the small differences between
+ * neighbouring centres stay accurate far from the origin. One chunk of
+ * faces, about 190 bytes each, is also held.
+ ***************************************************************************/
+class MeshQuality {
+
+    enum { FacesPerThread = 32 * 1024 }; // num chunk faces per thread
+    enum { NumWorst = 5 };              // num worst items reported
+    enum { MaxNonOrtho = 70 };          // max non-orthogonality, degrees
+    enum { MaxSkewness = 4 };           // max skewness
+    enum { MaxAspectRatio = 1000 };     // max aspect ratio
+    enum { NumOrthoBins = 9 };          // 10 degree non-orthogonality bins
+    enum { NumSkewBins = 5 };           // skewness bins
+    enum { NumAspectBins = 6 };         // aspect ratio bins
+
+    // the sums over the faces of a cell
+    struct CellSum {
+        double  ref_[3];    // first face centre, then the cell centre
+        double  vol_;       // 3x the volume, then the volume
+        float   moment_[3]; // volume weighted centre offset from ref_
+        float   area_[3];   // sum of the face area vector magnitudes
+    };
+
+    // a measured item and its value
+    struct Worst {
+        double      value_; // measured value
+        PWP_UINT64  item_;  // exported face or cell
+        PWP_UINT32  cell_;  // exported cell
+    };
+
+public:
+    static const PWP_UINT32 NoNeighbour = PWP_UINT32_MAX; // boundary face
+
+    // Constructor, fmt is the format of the bad face and cell sets
+    MeshQuality(const FoamFormat &fmt) :
+        sums_(),
+        isStarted_(),
+        centres_(),
+        chunkSize_((size_t)FacesPerThread * ParallelFor::numThreads()),
+        numChunk_(0),
+        nonOrthoSet_(fmt),
+        skewSet_(fmt),
+        aspectSet_(fmt),
+        volumeSet_(fmt),
+        hasSets_(false),
+        verts_(0)
+    {
+        clearStats();
+    }
+
+    // destructor
+    ~MeshQuality()
+    {
+    }
+
+    // Open the bad face and cell set files in the cwd. Their names are made
+    // unique in usedNames.
+    bool openSets(StringSet &usedNames)
+    {
+        hasSets_ = nonOrthoSet_.open(uniqueSafeFileName("nonOrthoFaces",
+                usedNames)) &&
+            skewSet_.open(uniqueSafeFileName("skewFaces", usedNames)) &&
+            aspectSet_.open(uniqueSafeFileName("highAspectRatioCells",
+                usedNames)) &&
+            volumeSet_.open(uniqueSafeFileName("zeroVolumeCells", usedNames));
+        return hasSets_;
+    }
+
+    // close the bad face and cell set files
+    bool closeSets()
+    {
+        bool ret = nonOrthoSet_.close();
+        ret = skewSet_.close() && ret;
+        ret = aspectSet_.close() && ret;
+        ret = volumeSet_.close() && ret;
+        hasSets_ = false;
+        return ret;
+    }
+
+    // prepare to sum the faces of numCells cells, reading their vertices
+    // from verts
+    void beginCells(PWP_UINT32 numCells, const VertexCache &verts)
+    {
+        verts_ = &verts;
+        clearStats();
+        const CellSum zero = { { 0.0, 0.0, 0.0 }, 0.0, { 0.0f, 0.0f, 0.0f },
+            { 0.0f, 0.0f, 0.0f } };
+        sums_.assign(numCells, zero);
+        isStarted_.assign(numCells, false);
+        allocChunk();
+    }
+
+    // add a streamed face to the sums of its cells
+    bool addCellFace(const PWGM_FACESTREAM_DATA &data)
+    {
+        if (!gatherFace(data, 0, 0)) {
+            return false;
+        }
+        if (chunkSize_ == numChunk_) {
+            sumChunk();
+        }
+        return true;
+    }
+
+    // Finish the cell sums and measure the cells. The bad cells are written
+    // by their index in ordering.
+    void endCells(const MeshOrdering &ordering)
+    {
+        sumChunk();
+        std::vector<bool>().swap(isStarted_);
+        numCells_ = sums_.size();
+        centres_.resize(3 * sums_.size());
+        for (PWP_UINT32 cell = 0; cell < (PWP_UINT32)sums_.size(); ++cell) {
+            CellSum &sum = sums_[cell];
+            if (RootVSmall < std::fabs(sum.vol_)) {
+                for (int ii = 0; ii < 3; ++ii) {
+                    sum.ref_[ii] += sum.moment_[ii] / sum.vol_;
                 }
-                fgets(buf, sizeof(buf), setFile);
             }
-            // write lines until we find one ending with a ')' char
-            while (!pwpFileEof(setFile)) {
-                fprintf(*this, "  %s", buf);
-                if (0 != strrchr(buf, ')')) {
-                    break; // last line written - stop
+            std::copy(sum.ref_, sum.ref_ + 3, &centres_[3 * (size_t)cell]);
+            sum.vol_ /= 3.0;
+            const PWP_UINT32 exported = ordering.cell(cell);
+            minVol_ = std::min(minVol_, sum.vol_);
+            maxVol_ = std::max(maxVol_, sum.vol_);
+            totalVol_ += sum.vol_;
+            if (sum.vol_ <= RootVSmall) {
+                ++numBadVol_;
+                if (hasSets_) {
+                    volumeSet_.writeAddress(exported);
                 }
-                fgets(buf, sizeof(buf), setFile);
             }
-            ret = !pwpFileEof(setFile);
-            pwpFileClose(setFile);
+
+            // the largest of the cartesian and the hydraulic aspect ratios
+            const float *a = sum.area_;
+            double aspect = std::max(std::max(a[0], a[1]), a[2]) /
+                (std::min(std::min(a[0], a[1]), a[2]) + RootVSmall);
+            aspect = std::max(aspect, (a[0] + a[1] + a[2]) /
+                (6.0 * std::pow(std::max(sum.vol_, RootVSmall), 2.0 / 3.0)));
+            static const double AspectBins[NumAspectBins - 1] =
+                { 2.0, 5.0, 10.0, 100.0, MaxAspectRatio };
+            ++aspectHist_[std::upper_bound(AspectBins, AspectBins +
+                NumAspectBins - 1, aspect) - AspectBins];
+            maxAspect_ = std::max(maxAspect_, aspect);
+            if (MaxAspectRatio < aspect) {
+                ++numBadAspect_;
+                if (hasSets_) {
+                    aspectSet_.writeAddress(exported);
+                }
+            }
+            addWorst(worstAspect_, aspect, exported, exported);
         }
-        // mark end of label list
-        pwpFileWriteStr("  ;\n", *this);
-        // allow subclass to write custom data after label list
-        this->writeLabelListSuffix(labelCnt);
-        // mark end of zone
-        pwpFileWriteStr("}\n", *this);
-        incrNumItems();
-        return ret;
+        std::vector<CellSum>().swap(sums_);
+    }
+
+    // measure a streamed face exported at index face and owned by the
+    // exported cell owner
+    bool addFace(const PWGM_FACESTREAM_DATA &data, PWP_UINT64 face,
+        PWP_UINT32 owner)
+    {
+        if (!gatherFace(data, face, owner)) {
+            return false;
+        }
+        if (chunkSize_ == numChunk_) {
+            measureChunk();
+        }
+        return true;
+    }
+
+    // measure the faces not yet measured and release the cell centres
+    void endFaces()
+    {
+        measureChunk();
+        std::vector<double>().swap(centres_);
+        freeChunk();
+    }
+
+    // get the report of the cell and face measures
+    void getReport(StringVec &msgs) const
+    {
+        std::ostringstream oss;
+        oss << "Mesh quality: " << numCells_ << " cells, volume min "
+            << minVol_ << " max " << maxVol_ << " total " << totalVol_
+            << ", " << numBadVol_ << " cells with zero or negative volume. "
+            << "Face area min " << minArea_ << ", " << numBadArea_
+            << " faces with zero area.";
+        msgs.push_back(oss.str());
+
+        static const char *AspectNames[NumAspectBins] =
+            { "1-2", "2-5", "5-10", "10-100", "100-1000", ">1000" };
+        oss.str("");
+        oss << "Aspect ratio: max " << maxAspect_ << ", " << numBadAspect_
+            << " cells above " << MaxAspectRatio << ".";
+        writeHistogram(oss, AspectNames, aspectHist_, NumAspectBins);
+        msgs.push_back(oss.str());
+        msgs.push_back(worstText("Worst aspect ratio cells:", worstAspect_,
+            false));
+
+        static const char *OrthoNames[NumOrthoBins] = { "0-10", "10-20",
+            "20-30", "30-40", "40-50", "50-60", "60-70", "70-80", "80-90" };
+        oss.str("");
+        oss << "Non-orthogonality: max " << maxNonOrtho_ << " average "
+            << (sumNonOrtho_ / std::max(numInternal_, (PWP_UINT64)1))
+            << " degrees, " << numBadNonOrtho_ << " faces above "
+            << MaxNonOrtho << ".";
+        writeHistogram(oss, OrthoNames, orthoHist_, NumOrthoBins);
+        msgs.push_back(oss.str());
+        msgs.push_back(worstText("Worst non-orthogonal faces:",
+            worstNonOrtho_, true));
+
+        static const char *SkewNames[NumSkewBins] =
+            { "0-0.5", "0.5-1", "1-2", "2-4", ">4" };
+        oss.str("");
+        oss << "Skewness: max " << maxSkew_ << ", " << numBadSkew_
+            << " faces above " << MaxSkewness << ".";
+        writeHistogram(oss, SkewNames, skewHist_, NumSkewBins);
+        msgs.push_back(oss.str());
+        msgs.push_back(worstText("Worst skew faces:", worstSkew_, true));
+    }
+
+private:
+    // add a streamed face to the chunk
+    bool gatherFace(const PWGM_FACESTREAM_DATA &data, PWP_UINT64 face,
+        PWP_UINT32 owner)
+    {
+        const PWGM_ELEMDATA &elem = data.elemData;
+        if ((elem.vertCnt < 3) || (4 < elem.vertCnt)) {
+            return false;
+        }
+        const size_t k = numChunk_;
+        PWGM_XYZVAL xyz[3];
+        for (PWP_UINT32 ii = 0; ii < 4; ++ii) {
+            // reversed, as exported, so the normal points out of the owner.
+            // A triangle repeats its last vertex.
+            const PWP_UINT32 vert = elem.vertCnt - 1 - std::min(ii,
+                elem.vertCnt - 1);
+            if (!verts_->getXYZ(xyz, elem, vert)) {
+                return false;
+            }
+            x_[ii][k] = xyz[0];
+            y_[ii][k] = xyz[1];
+            z_[ii][k] = xyz[2];
+        }
+        quad_[k] = (4 == elem.vertCnt) ? 1.0 : 0.0;
+        owner_[k] = data.owner.cellIndex;
+        neighbour_[k] = (PWGM_FACETYPE_BOUNDARY == data.type) ? NoNeighbour :
+            data.neighborCellIndex;
+        face_[k] = face;
+        exportedOwner_[k] = owner;
+        ++numChunk_;
+        return true;
+    }
+
+    // reset the measures
+    void clearStats()
+    {
+        numCells_ = 0;
+        numInternal_ = 0;
+        minVol_ = std::numeric_limits<double>::max();
+        maxVol_ = -std::numeric_limits<double>::max();
+        totalVol_ = 0.0;
+        numBadVol_ = 0;
+        minArea_ = std::numeric_limits<double>::max();
+        numBadArea_ = 0;
+        maxAspect_ = 0.0;
+        numBadAspect_ = 0;
+        maxNonOrtho_ = 0.0;
+        sumNonOrtho_ = 0.0;
+        numBadNonOrtho_ = 0;
+        maxSkew_ = 0.0;
+        numBadSkew_ = 0;
+        std::fill(aspectHist_, aspectHist_ + NumAspectBins, 0);
+        std::fill(orthoHist_, orthoHist_ + NumOrthoBins, 0);
+        std::fill(skewHist_, skewHist_ + NumSkewBins, 0);
+        worstAspect_.clear();
+        worstNonOrtho_.clear();
+        worstSkew_.clear();
+    }
+
+    // allocate the face chunk
+    void allocChunk()
+    {
+        numChunk_ = 0;
+        for (int ii = 0; ii < 4; ++ii) {
+            x_[ii].resize(chunkSize_);
+            y_[ii].resize(chunkSize_);
+            z_[ii].resize(chunkSize_);
+        }
+        for (int ii = 0; ii < 3; ++ii) {
+            area_[ii].resize(chunkSize_);
+            centre_[ii].resize(chunkSize_);
+        }
+        quad_.resize(chunkSize_);
+        owner_.resize(chunkSize_);
+        neighbour_.resize(chunkSize_);
+        face_.resize(chunkSize_);
+        exportedOwner_.resize(chunkSize_);
+        nonOrtho_.resize(chunkSize_);
+        skew_.resize(chunkSize_);
+    }
+
+    // release the face chunk
+    void freeChunk()
+    {
+        numChunk_ = 0;
+        for (int ii = 0; ii < 4; ++ii) {
+            std::vector<double>().swap(x_[ii]);
+            std::vector<double>().swap(y_[ii]);
+            std::vector<double>().swap(z_[ii]);
+        }
+        for (int ii = 0; ii < 3; ++ii) {
+            std::vector<double>().swap(area_[ii]);
+            std::vector<double>().swap(centre_[ii]);
+        }
+        std::vector<double>().swap(quad_);
+        std::vector<PWP_UINT32>().swap(owner_);
+        std::vector<PWP_UINT32>().swap(neighbour_);
+        std::vector<PWP_UINT64>().swap(face_);
+        std::vector<PWP_UINT32>().swap(exportedOwner_);
+        std::vector<double>().swap(nonOrtho_);
+        std::vector<double>().swap(skew_);
+    }
+
+    // add the chunk's faces to the sums of their cells
+    void sumChunk()
+    {
+        GeometryBody body(*this);
+        ParallelFor::run(numChunk_, body, FacesPerThread);
+        for (size_t k = 0; k < numChunk_; ++k) {
+            addToCell(owner_[k], k, 1.0);
+            if (NoNeighbour != neighbour_[k]) {
+                addToCell(neighbour_[k], k, -1.0);
+            }
+        }
+        numChunk_ = 0;
+    }
+
+    // add face k of the chunk to the sums of a cell, sign is 1 if the face
+    // normal points out of the cell and -1 if it points in
+    void addToCell(PWP_UINT32 cell, size_t k, double sign)
+    {
+        CellSum &sum = sums_[cell];
+        const double c[3] = { centre_[0][k], centre_[1][k], centre_[2][k] };
+        if (!isStarted_[cell]) {
+            isStarted_[cell] = true;
+            sum.ref_[0] = c[0];
+            sum.ref_[1] = c[1];
+            sum.ref_[2] = c[2];
+        }
+        // 3x the volume of the pyramid from ref_ to the face
+        double d[3];
+        double pyr3Vol = 0.0;
+        for (int ii = 0; ii < 3; ++ii) {
+            d[ii] = c[ii] - sum.ref_[ii];
+            pyr3Vol += area_[ii][k] * d[ii];
+        }
+        pyr3Vol *= sign;
+        sum.vol_ += pyr3Vol;
+        for (int ii = 0; ii < 3; ++ii) {
+            sum.moment_[ii] += (float)(0.75 * pyr3Vol * d[ii]);
+            sum.area_[ii] += (float)std::fabs(area_[ii][k]);
+        }
+    }
+
+    // measure the chunk's faces and add them to the face measures
+    void measureChunk()
+    {
+        QualityBody body(*this);
+        ParallelFor::run(numChunk_, body, FacesPerThread);
+        static const double SkewBins[NumSkewBins - 1] =
+            { 0.5, 1.0, 2.0, MaxSkewness };
+        for (size_t k = 0; k < numChunk_; ++k) {
+            const double area = std::sqrt(area_[0][k] * area_[0][k] +
+                area_[1][k] * area_[1][k] + area_[2][k] * area_[2][k]);
+            minArea_ = std::min(minArea_, area);
+            if (area <= RootVSmall) {
+                ++numBadArea_;
+            }
+            if (NoNeighbour != neighbour_[k]) {
+                const double ortho = nonOrtho_[k];
+                ++numInternal_;
+                sumNonOrtho_ += ortho;
+                maxNonOrtho_ = std::max(maxNonOrtho_, ortho);
+                ++orthoHist_[std::min((int)(ortho / 10.0),
+                    (int)NumOrthoBins - 1)];
+                if (MaxNonOrtho < ortho) {
+                    ++numBadNonOrtho_;
+                    if (hasSets_) {
+                        nonOrthoSet_.writeAddress(face_[k]);
+                    }
+                }
+                addWorst(worstNonOrtho_, ortho, face_[k], exportedOwner_[k]);
+            }
+            const double skew = skew_[k];
+            maxSkew_ = std::max(maxSkew_, skew);
+            ++skewHist_[std::upper_bound(SkewBins, SkewBins + NumSkewBins - 1,
+                skew) - SkewBins];
+            if (MaxSkewness < skew) {
+                ++numBadSkew_;
+                if (hasSets_) {
+                    skewSet_.writeAddress(face_[k]);
+                }
+            }
+            addWorst(worstSkew_, skew, face_[k], exportedOwner_[k]);
+        }
+        numChunk_ = 0;
+    }
+
+    // Compute the area vector and centre of the chunk's faces [begin, end)
+    // as OpenFOAM does, from the triangles joining each edge to the vertex
+    // average. A triangle's repeated vertex adds an empty triangle.
+    void measureGeometry(size_t begin, size_t end)
+    {
+        for (size_t k = begin; k < end; ++k) {
+            const double n = 3.0 + quad_[k];
+            const double cx = (x_[0][k] + x_[1][k] + x_[2][k] +
+                quad_[k] * x_[3][k]) / n;
+            const double cy = (y_[0][k] + y_[1][k] + y_[2][k] +
+                quad_[k] * y_[3][k]) / n;
+            const double cz = (z_[0][k] + z_[1][k] + z_[2][k] +
+                quad_[k] * z_[3][k]) / n;
+            double sumN[3] = { 0.0, 0.0, 0.0 };
+            double sumA = 0.0;
+            double sumAc[3] = { 0.0, 0.0, 0.0 };
+            for (int ii = 0; ii < 4; ++ii) {
+                const int jj = (ii + 1) & 3;
+                const double ex = x_[jj][k] - x_[ii][k];
+                const double ey = y_[jj][k] - y_[ii][k];
+                const double ez = z_[jj][k] - z_[ii][k];
+                const double fx = cx - x_[ii][k];
+                const double fy = cy - y_[ii][k];
+                const double fz = cz - z_[ii][k];
+                const double nx = ey * fz - ez * fy;
+                const double ny = ez * fx - ex * fz;
+                const double nz = ex * fy - ey * fx;
+                const double a = std::sqrt(nx * nx + ny * ny + nz * nz);
+                sumN[0] += nx;
+                sumN[1] += ny;
+                sumN[2] += nz;
+                sumA += a;
+                sumAc[0] += a * (x_[ii][k] + x_[jj][k] + cx);
+                sumAc[1] += a * (y_[ii][k] + y_[jj][k] + cy);
+                sumAc[2] += a * (z_[ii][k] + z_[jj][k] + cz);
+            }
+            const bool hasArea = (RootVSmall < sumA);
+            const double inv = hasArea ? (1.0 / (3.0 * sumA)) : 0.0;
+            centre_[0][k] = hasArea ? (sumAc[0] * inv) : cx;
+            centre_[1][k] = hasArea ? (sumAc[1] * inv) : cy;
+            centre_[2][k] = hasArea ? (sumAc[2] * inv) : cz;
+            area_[0][k] = 0.5 * sumN[0];
+            area_[1][k] = 0.5 * sumN[1];
+            area_[2][k] = 0.5 * sumN[2];
+        }
+    }
+
+    // Compute the non-orthogonality and skewness of the chunk's faces
+    // [begin, end) as checkMesh does. A boundary face is measured against
+    // the projection of its owner's centre onto its normal.
+    void measureQuality(size_t begin, size_t end)
+    {
+        measureGeometry(begin, end);
+        for (size_t k = begin; k < end; ++k) {
+            const double *own = &centres_[3 * (size_t)owner_[k]];
+            const double s[3] = { area_[0][k], area_[1][k], area_[2][k] };
+            const double magS = std::sqrt(dot(s, s));
+            const double cpf[3] = { centre_[0][k] - own[0],
+                centre_[1][k] - own[1], centre_[2][k] - own[2] };
+            double d[3];
+            const bool isInternal = (NoNeighbour != neighbour_[k]);
+            if (isInternal) {
+                const double *nei = &centres_[3 * (size_t)neighbour_[k]];
+                for (int ii = 0; ii < 3; ++ii) {
+                    d[ii] = nei[ii] - own[ii];
+                }
+            }
+            else {
+                const double dn = dot(s, cpf) / (magS * magS + RootVSmall);
+                for (int ii = 0; ii < 3; ++ii) {
+                    d[ii] = s[ii] * dn;
+                }
+            }
+            const double magD = std::sqrt(dot(d, d));
+
+            // the angle between the face normal and the cell centres
+            const double cosine = std::max(-1.0, std::min(1.0,
+                dot(d, s) / (magD * magS + RootVSmall)));
+            nonOrtho_[k] = isInternal ? (std::acos(cosine) * RadToDeg) :
+                0.0;
+
+            // the distance of the face centre from where the line between
+            // the cell centres crosses the face, relative to the face size
+            // in that direction
+            const double t = dot(s, cpf) / (dot(s, d) + RootVSmall);
+            double sv[3];
+            for (int ii = 0; ii < 3; ++ii) {
+                sv[ii] = cpf[ii] - t * d[ii];
+            }
+            const double magSv = std::sqrt(dot(sv, sv));
+            double fd = (isInternal ? 0.2 : 0.4) * magD + RootVSmall;
+            for (int ii = 0; ii < 4; ++ii) {
+                const double e[3] = { x_[ii][k] - centre_[0][k],
+                    y_[ii][k] - centre_[1][k], z_[ii][k] - centre_[2][k] };
+                fd = std::max(fd, std::fabs(dot(sv, e)) /
+                    (magSv + RootVSmall));
+            }
+            skew_[k] = magSv / fd;
+        }
+    }
+
+    // get the dot product of two vectors
+    static double dot(const double a[3], const double b[3])
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    // keep the NumWorst largest values in worst, largest first
+    static void addWorst(std::vector<Worst> &worst, double value,
+        PWP_UINT64 item, PWP_UINT32 cell)
+    {
+        if ((NumWorst == worst.size()) && (value <= worst.back().value_)) {
+            return;
+        }
+        const Worst w = { value, item, cell };
+        std::vector<Worst>::iterator it = worst.begin();
+        while ((it != worst.end()) && (value <= it->value_)) {
+            ++it;
+        }
+        worst.insert(it, w);
+        if (NumWorst < worst.size()) {
+            worst.pop_back();
+        }
+    }
+
+    // write the counts of a histogram's bins
+    static void writeHistogram(std::ostream &os, const char * const *names,
+        const PWP_UINT64 *counts, int numBins)
+    {
+        os << " Histogram";
+        for (int ii = 0; ii < numBins; ++ii) {
+            os << ((0 == ii) ? " " : ", ") << names[ii] << ": " << counts[ii];
+        }
+        os << ".";
     }
 
-private:
-    // write zone label list to file
-    virtual void writeLabelListPrefix()
-    {
-        // assumes object_ is of form "xxxxZones"
-        // write as "xxxxZone" (singular)
-        fprintf(*this, "  type %8.8s;\n", object());
-        // write as "xxxx"
-        fprintf(*this, "  %4.4sLabels List<label>\n", object());
-    }
+    // get the text listing the worst faces or cells
+    static std::string worstText(const char *title,
+        const std::vector<Worst> &worst, bool isFace)
+    {
+        std::ostringstream oss;
+        oss << title;
+        for (size_t ii = 0; ii < worst.size(); ++ii) {
+            oss << ((0 == ii) ? " " : ", ");
+            if (isFace) {
+                oss << "face " << worst[ii].item_ << " of ";
+            }
+            oss << "cell " << worst[ii].cell_ << " (" << worst[ii].value_
+                << ")";
+        }
+        if (worst.empty()) {
+            oss << " none";
+        }
+        return oss.str();
+    }
+
+    // ParallelFor body computing the area and centre of chunk faces
+    struct GeometryBody {
+        GeometryBody(MeshQuality &quality) :
+            quality_(quality)
+        {
+        }
+
+        void operator()(PWP_UINT32, PWP_UINT64 begin, PWP_UINT64 end)
+        {
+            quality_.measureGeometry((size_t)begin, (size_t)end);
+        }
+
+        MeshQuality &quality_;
+    };
+
+    // ParallelFor body measuring chunk faces
+    struct QualityBody {
+        QualityBody(MeshQuality &quality) :
+            quality_(quality)
+        {
+        }
+
+        void operator()(PWP_UINT32, PWP_UINT64 begin, PWP_UINT64 end)
+        {
+            quality_.measureQuality((size_t)begin, (size_t)end);
+        }
 
-    // allow subclass to write information after label list
-    virtual void writeLabelListSuffix(unsigned long labelCnt)
-    {
-        (void)labelCnt; // do nothing
-    }
+        MeshQuality &quality_;
+    };
+
+    static const double RootVSmall; // smallest significant length or volume
+    static const double RadToDeg;   // degrees per radian
+
+    std::vector<CellSum>    sums_;          // the sums of each cell
+    std::vector<bool>       isStarted_;     // true if a cell has a face
+    std::vector<double>     centres_;       // x, y, z of each cell centre
+    size_t                  chunkSize_;     // num faces held in a chunk
+    size_t                  numChunk_;      // num faces in the chunk
+    std::vector<double>     x_[4];          // chunk face vertex x
+    std::vector<double>     y_[4];          // chunk face vertex y
+    std::vector<double>     z_[4];          // chunk face vertex z
+    std::vector<double>     quad_;          // 1 for a chunk quad, else 0
+    std::vector<double>     area_[3];       // chunk face area vectors
+    std::vector<double>     centre_[3];     // chunk face centres
+    std::vector<PWP_UINT32> owner_;         // chunk face streamed owner
+    std::vector<PWP_UINT32> neighbour_;     // chunk face streamed neighbour
+    std::vector<PWP_UINT64> face_;          // chunk face exported index
+    std::vector<PWP_UINT32> exportedOwner_; // chunk face exported owner
+    std::vector<double>     nonOrtho_;      // chunk face non-orthogonality
+    std::vector<double>     skew_;          // chunk face skewness
+    FoamFaceSetFile         nonOrthoSet_;   // non-orthogonal faces
+    FoamFaceSetFile         skewSet_;       // skew faces
+    FoamCellSetFile         aspectSet_;     // high aspect ratio cells
+    FoamCellSetFile         volumeSet_;     // zero or negative volume cells
+    bool                    hasSets_;       // true if the sets are open
+    const VertexCache *     verts_;         // the face vertices
+    PWP_UINT64              numCells_;      // num cells measured
+    PWP_UINT64              numInternal_;   // num internal faces measured
+    double                  minVol_;        // min cell volume
+    double                  maxVol_;        // max cell volume
+    double                  totalVol_;      // sum of the cell volumes
+    PWP_UINT64              numBadVol_;     // num cells without volume
+    double                  minArea_;       // min face area
+    PWP_UINT64              numBadArea_;    // num faces without area
+    double                  maxAspect_;     // max cell aspect ratio
+    PWP_UINT64              numBadAspect_;  // num high aspect ratio cells
+    double                  maxNonOrtho_;   // max face non-orthogonality
+    double                  sumNonOrtho_;   // sum of non-orthogonality
+    PWP_UINT64              numBadNonOrtho_; // num non-orthogonal faces
+    double                  maxSkew_;       // max face skewness
+    PWP_UINT64              numBadSkew_;    // num skew faces
+    PWP_UINT64              aspectHist_[NumAspectBins]; // aspect bins
+    PWP_UINT64              orthoHist_[NumOrthoBins];   // non-ortho bins
+    PWP_UINT64              skewHist_[NumSkewBins];     // skewness bins
+    std::vector<Worst>      worstAspect_;   // worst aspect ratio cells
+    std::vector<Worst>      worstNonOrtho_; // worst non-orthogonal faces
+    std::vector<Worst>      worstSkew_;     // worst skew faces
 };
 
+const double MeshQuality::RootVSmall = 1.0e-150;
+const double MeshQuality::RadToDeg = 57.295779513082321;
+
 
 /***************************************************************************
- * Class FoamCellZoneFile is used to write an OpenFOAM "cellZones" file.
- * A cell zone contains cells with the same volume condition.
+ * Class DecomposedCaseWriter writes the mesh and the *ProcAddressing files
+ * of each subdomain of a partitioned PolyMesh, as decomposePar would.
+ *
+ * A subdomain's faces are its internal faces, then its faces of each
+ * original patch, then one processor patch per neighbouring subdomain. All
+ * are kept in their original relative order so both sides of a processor
+ * patch list the faces alike. A processor face whose original owner is on
+ * the other side is flipped and has a negative faceProcAddressing entry.
+ *
+ * The cells and faces are bucketed by subdomain once, so each subdomain is
+ * written from its own bucket. The buckets hold 16 bytes per cell and 8
+ * bytes per face, plus 8 bytes per processor face for its second side.
+ *
+ * A subdomain's files are written concurrently, one thread per file, and
+ * the subdomains are written in order, so each collated container receives
+ * its blocks in order.
  ***************************************************************************/
-class FoamCellZoneFile : public FoamZoneFile {
+class DecomposedCaseWriter {
+
+    // the files of a subdomain
+    enum FileId {
+        PointsFile,
+        FacesFile,
+        OwnerFile,
+        NeighbourFile,
+        BoundaryFile,
+        CellAddressingFile,
+        PointAddressingFile,
+        FaceAddressingFile,
+        BoundaryAddressingFile,
+        NumFiles
+    };
+
+    // the faces, points and patches of a subdomain
+    struct Subdomain {
+        PWP_UINT32              proc_;      // subdomain index
+        std::vector<PWP_INT64>  faceAddr_;  // signed 1-based original faces
+        std::vector<PWP_UINT64> owner_;     // local owner of each face
+        std::vector<PWP_UINT64> neighbour_; // local neighbour of internal faces
+        BcStats                 patches_;   // original and processor patches
+        std::vector<PWP_INT64>  patchAddr_; // original patch of each patch
+        std::vector<PWP_UINT64> points_;    // original points in local order
+    };
+
+    // ParallelFor body writing the files of a subdomain
+    struct FileBody {
+        FileBody(const DecomposedCaseWriter &writer, const Subdomain &sub) :
+            writer_(writer),
+            sub_(sub)
+        {
+        }
+
+        void operator()(PWP_UINT32, PWP_UINT64 begin, PWP_UINT64 end)
+        {
+            for (PWP_UINT64 ii = begin; ii < end; ++ii) {
+                ok_[ii] = writer_.writeFile((FileId)ii, sub_);
+            }
+        }
+
+        // return true if every file was written
+        bool ok() const
+        {
+            return std::find(ok_, ok_ + NumFiles, false) == (ok_ + NumFiles);
+        }
+
+        const DecomposedCaseWriter &writer_;    // writes each file
+        const Subdomain &           sub_;       // the subdomain written
+        bool                        ok_[NumFiles]; // true if file written
+    };
+
 public:
-    // Default constructor sets object to "cellZones"
-    FoamCellZoneFile() :
-        FoamZoneFile("cellZones")
+    // Constructor
+    DecomposedCaseWriter(const PolyMesh &mesh, const BcStats &patches,
+            const std::vector<PWP_UINT32> &cellProc, PWP_UINT32 numProcs,
+            const FoamFormat &fmt, PWP_UINT prec, bool compactFaces,
+            size_t bufSize, bool compress) :
+        mesh_(mesh),
+        patches_(patches),
+        cellProc_(cellProc),
+        fmt_(fmt),
+        prec_(prec),
+        compactFaces_(compactFaces),
+        bufSize_(bufSize),
+        compress_(compress),
+        cellLocal_(cellProc.size(), 0),
+        procCellStart_(numProcs + 1, 0),
+        procCells_(cellProc.size()),
+        procFaceStart_(),
+        procFaces_()
     {
+        // cells keep their relative order within each subdomain
+        std::vector<PWP_UINT64> numProcCells(numProcs, 0);
+        for (size_t cell = 0; cell < cellProc_.size(); ++cell) {
+            cellLocal_[cell] = numProcCells[cellProc_[cell]]++;
+        }
+        for (PWP_UINT32 proc = 0; proc < numProcs; ++proc) {
+            procCellStart_[proc + 1] = procCellStart_[proc] +
+                numProcCells[proc];
+        }
+        for (size_t cell = 0; cell < cellProc_.size(); ++cell) {
+            const PWP_UINT32 proc = cellProc_[cell];
+            procCells_[procCellStart_[proc] + cellLocal_[cell]] = cell;
+        }
+        bucketFaces(numProcs);
     }
 
     // destructor
-    virtual ~FoamCellZoneFile()
+    ~DecomposedCaseWriter()
     {
     }
-};
-
 
-/***************************************************************************
- * Class FoamFaceZoneFile is used to write an OpenFOAM "faceZones" file.
- * A face zone contains faces with the same boundary condition.
- ***************************************************************************/
-class FoamFaceZoneFile : public FoamZoneFile {
-public:
-    // Default constructor sets object to "faceZones"
-    FoamFaceZoneFile() :
-        FoamZoneFile("faceZones")
+    // Write the files of subdomain proc to the current directory, or to the
+    // collated containers when FoamFile::isCollated()
+    bool write(PWP_UINT32 proc) const
     {
-    }
+        Subdomain sub;
+        sub.proc_ = proc;
+        collectFaces(proc, sub.faceAddr_, sub.owner_, sub.neighbour_,
+            sub.patches_, sub.patchAddr_);
+
+        // points keep their relative order
+        std::vector<PWP_UINT64> &points = sub.points_;
+        for (size_t ii = 0; ii < sub.faceAddr_.size(); ++ii) {
+            const PWP_UINT64 face = faceIndex(sub.faceAddr_[ii]);
+            points.insert(points.end(),
+                mesh_.faceVerts_.begin() + mesh_.faceStart_[face],
+                mesh_.faceVerts_.begin() + mesh_.faceStart_[face + 1]);
+        }
+        std::sort(points.begin(), points.end());
+        points.erase(std::unique(points.begin(), points.end()), points.end());
 
-    // destructor
-    virtual ~FoamFaceZoneFile()
-    {
+        FileBody body(*this, sub);
+        ParallelFor::run(NumFiles, body, 1);
+        return body.ok();
     }
 
 private:
-    // callback from parent class after face zones have been written
-    virtual void writeLabelListSuffix(unsigned long labelCnt)
+    // get the original face index of a faceProcAddressing entry
+    static PWP_UINT64 faceIndex(PWP_INT64 addr)
     {
-        // pointwise faces are never flipped
-        fprintf(*this, "  flipMap List<bool> %lu{0};\n",
-            (unsigned long)labelCnt);
+        return (PWP_UINT64)((addr < 0) ? -addr : addr) - 1;
     }
-};
-
 
-/***************************************************************************
- * Class BcStat represents a single face range with an OpenFOAM boundary
- * condition.
- ***************************************************************************/
-class BcStat {
-public:
-    // Default constructor
-    BcStat() :
-        name_(),
-        type_(),
-        nFaces_(0),
-        startFace_(0)
+    // Bucket the faces by the subdomains of their cells in two passes, one
+    // to count and one to fill. A processor face is in both buckets. Each
+    // bucket keeps the original face order.
+    void bucketFaces(PWP_UINT32 numProcs)
     {
+        const PWP_UINT64 numInternal = mesh_.numInternalFaces();
+        const PWP_UINT64 numFaces = mesh_.numFaces();
+        std::vector<PWP_UINT64> next(numProcs + 1, 0);
+        for (PWP_UINT64 face = 0; face < numFaces; ++face) {
+            const PWP_UINT32 ownProc = cellProc_[mesh_.owner_[face]];
+            ++next[ownProc + 1];
+            if (face < numInternal) {
+                const PWP_UINT32 neiProc = cellProc_[mesh_.neighbour_[face]];
+                if (neiProc != ownProc) {
+                    ++next[neiProc + 1];
+                }
+            }
+        }
+        for (PWP_UINT32 proc = 0; proc < numProcs; ++proc) {
+            next[proc + 1] += next[proc];
+        }
+        procFaceStart_ = next;
+        procFaces_.resize(next[numProcs]);
+        for (PWP_UINT64 face = 0; face < numFaces; ++face) {
+            const PWP_UINT32 ownProc = cellProc_[mesh_.owner_[face]];
+            procFaces_[next[ownProc]++] = face;
+            if (face < numInternal) {
+                const PWP_UINT32 neiProc = cellProc_[mesh_.neighbour_[face]];
+                if (neiProc != ownProc) {
+                    procFaces_[next[neiProc]++] = face;
+                }
+            }
+        }
     }
 
-    // Copy constructor, needed to store in value array
-    BcStat(const BcStat& rhs) :
-        name_(rhs.name_),
-        type_(rhs.type_),
-        nFaces_(rhs.nFaces_),
-        startFace_(rhs.startFace_)
+    // gather the faces of subdomain proc in subdomain order
+    void collectFaces(PWP_UINT32 proc, std::vector<PWP_INT64> &faceAddr,
+        std::vector<PWP_UINT64> &owner, std::vector<PWP_UINT64> &neighbour,
+        BcStats &patches, std::vector<PWP_INT64> &patchAddr) const
     {
+        // internal faces, processor faces are grouped by neighbour subdomain
+        typedef std::map<PWP_UINT32, std::vector<PWP_UINT64> > ProcFacesMap;
+        ProcFacesMap procFaces;
+        const PWP_UINT64 numInternal = mesh_.numInternalFaces();
+        PWP_UINT64 pos = procFaceStart_[proc];
+        const PWP_UINT64 end = procFaceStart_[proc + 1];
+        for (; (pos < end) && (procFaces_[pos] < numInternal); ++pos) {
+            const PWP_UINT64 face = procFaces_[pos];
+            const PWP_UINT32 ownProc = cellProc_[mesh_.owner_[face]];
+            const PWP_UINT32 neiProc = cellProc_[mesh_.neighbour_[face]];
+            if ((ownProc == proc) && (neiProc == proc)) {
+                faceAddr.push_back((PWP_INT64)face + 1);
+                owner.push_back(cellLocal_[mesh_.owner_[face]]);
+                neighbour.push_back(cellLocal_[mesh_.neighbour_[face]]);
+            }
+            else if (ownProc == proc) {
+                procFaces[neiProc].push_back(face);
+            }
+            else if (neiProc == proc) {
+                procFaces[ownProc].push_back(face);
+            }
+        }
+
+        // original patches, kept even if empty
+        for (size_t ii = 0; ii < patches_.size(); ++ii) {
+            BcStat patch(patches_[ii]);
+            patch.startFace_ = faceAddr.size();
+            const PWP_UINT64 last = patches_[ii].startFace_ +
+                patches_[ii].nFaces_;
+            while ((pos < end) && (procFaces_[pos] < patches_[ii].startFace_)) {
+                ++pos;
+            }
+            for (; (pos < end) && (procFaces_[pos] < last); ++pos) {
+                const PWP_UINT64 face = procFaces_[pos];
+                faceAddr.push_back((PWP_INT64)face + 1);
+                owner.push_back(cellLocal_[mesh_.owner_[face]]);
+            }
+            patch.nFaces_ = faceAddr.size() - patch.startFace_;
+            patches.push_back(patch);
+            patchAddr.push_back((PWP_INT64)ii);
+        }
+
+        // processor patches
+        ProcFacesMap::const_iterator it = procFaces.begin();
+        for (; it != procFaces.end(); ++it) {
+            std::ostringstream oss;
+            oss << "procBoundary" << proc << "to" << it->first;
+            BcStat patch;
+            patch.name_ = oss.str();
+            patch.type_ = "processor";
+            patch.startFace_ = faceAddr.size();
+            patch.nFaces_ = it->second.size();
+            patch.myProcNo_ = (PWP_INT32)proc;
+            patch.neighbProcNo_ = (PWP_INT32)it->first;
+            patches.push_back(patch);
+            patchAddr.push_back(-1);
+            for (size_t ii = 0; ii < it->second.size(); ++ii) {
+                const PWP_UINT64 face = it->second[ii];
+                if (cellProc_[mesh_.owner_[face]] == proc) {
+                    faceAddr.push_back((PWP_INT64)face + 1);
+                    owner.push_back(cellLocal_[mesh_.owner_[face]]);
+                }
+                else {
+                    // flipped so the normal points out of the local cell
+                    faceAddr.push_back(-((PWP_INT64)face + 1));
+                    owner.push_back(cellLocal_[mesh_.neighbour_[face]]);
+                }
+            }
+        }
     }
 
-    // Destructor
-    ~BcStat()
+    // write one file of a subdomain
+    bool writeFile(FileId id, const Subdomain &sub) const
     {
+        switch (id) {
+        case PointsFile:
+            return writePoints(sub.points_);
+        case FacesFile:
+            return writeFaces(sub.faceAddr_, sub.points_);
+        case OwnerFile:
+            return writeAddresses("owner", sub.owner_);
+        case NeighbourFile:
+            return writeAddresses("neighbour", sub.neighbour_);
+        case BoundaryFile:
+            return writeBoundary(sub.patches_);
+        case CellAddressingFile:
+            return writeCellAddressing(sub.proc_);
+        case PointAddressingFile:
+            return writeAddresses("pointProcAddressing", sub.points_);
+        case FaceAddressingFile:
+            return writeSignedAddresses("faceProcAddressing", sub.faceAddr_);
+        case BoundaryAddressingFile:
+            return writeSignedAddresses("boundaryProcAddressing",
+                sub.patchAddr_);
+        default:
+            return false;
+        }
     }
 
-    // Assignment operator
-    BcStat& operator=(const BcStat& rhs)
+    // use the mesh file buffer size and compression for file
+    void setFileOptions(FoamFile &file) const
     {
-        name_ = rhs.name_;
-        type_ = rhs.type_;
-        nFaces_ = rhs.nFaces_;
-        startFace_ = rhs.startFace_;
-        return *this;
+        file.setBufferSize(bufSize_);
+        file.setCompression(compress_);
     }
 
-    std::string name_;      // boundary condition name
-    std::string type_;      // boundary condition type
-    PWP_UINT32  nFaces_;    // number of faces in this range
-    PWP_UINT32  startFace_; // first face number in this range
-};
-
-// Value array of BcStat
-typedef std::vector<BcStat> BcStats;
-
+    // write the subdomain points file
+    bool writePoints(const std::vector<PWP_UINT64> &points) const
+    {
+        FoamPointFile file(prec_, fmt_);
+        setFileOptions(file);
+        if (!file.open(0, points.size())) {
+            return false;
+        }
+        for (size_t ii = 0; ii < points.size(); ++ii) {
+            const PWGM_XYZVAL *xyz = &mesh_.points_[3 * points[ii]];
+            PWGM_VERTDATA v;
+            v.x = xyz[0];
+            v.y = xyz[1];
+            v.z = xyz[2];
+            file.writeVertex(v);
+        }
+        return file.close();
+    }
 
-/***************************************************************************
- * Class FoamBoundaryFile is used to write an OpenFOAM "boundary" file.
- * The boundary file contains the face range to which each boundary
- * condition is applied.
- ***************************************************************************/
-class FoamBoundaryFile : public FoamFile {
-public:
-    // Default constructor sets class name and file name
-    FoamBoundaryFile() :
-        FoamFile("polyBoundaryMesh", "boundary")
+    // write the subdomain faces file with local point indices
+    bool writeFaces(const std::vector<PWP_INT64> &faceAddr,
+        const std::vector<PWP_UINT64> &points) const
     {
+        FoamFacesFile file(false, 0, fmt_);
+        file.setCompact(compactFaces_);
+        setFileOptions(file);
+        if (!file.openFaces(faceAddr.size())) {
+            return false;
+        }
+        std::vector<PWP_UINT64> ndx;
+        for (size_t ii = 0; ii < faceAddr.size(); ++ii) {
+            const PWP_UINT64 face = faceIndex(faceAddr[ii]);
+            const PWP_UINT64 first = mesh_.faceStart_[face];
+            const PWP_UINT32 cnt = (PWP_UINT32)(mesh_.faceStart_[face + 1] -
+                first);
+            ndx.resize(cnt);
+            for (PWP_UINT32 jj = 0; jj < cnt; ++jj) {
+                // a flipped face keeps its first vertex
+                const PWP_UINT32 kk = (faceAddr[ii] < 0) ? ((cnt - jj) % cnt) :
+                    jj;
+                ndx[jj] = (PWP_UINT64)(std::lower_bound(points.begin(),
+                    points.end(), mesh_.faceVerts_[first + kk]) -
+                    points.begin());
+            }
+            file.writeFace(&ndx[0], cnt);
+        }
+        return file.close();
     }
 
-    // destructor
-    ~FoamBoundaryFile()
+    // write the subdomain boundary file
+    bool writeBoundary(const BcStats &patches) const
     {
+        FoamBoundaryFile file;
+        setFileOptions(file);
+        if (!file.open(0, patches.size())) {
+            return false;
+        }
+        file.writeBoundaries(patches);
+        return file.close();
     }
 
-    /*
-       bndry file contains entries of the form
+    // write the original index of each subdomain cell
+    bool writeCellAddressing(PWP_UINT32 proc) const
+    {
+        const std::vector<PWP_UINT64> cells(
+            procCells_.begin() + procCellStart_[proc],
+            procCells_.begin() + procCellStart_[proc + 1]);
+        return writeAddresses("cellProcAddressing", cells);
+    }
 
-        <bcName:string>
-        {
-            type <bcPhyType:string>;
-            nFaces <numFacesInBc:integer>;
-            startFace <firstBcFaceIndex:integer>;
+    // write a labelList file
+    bool writeAddresses(const char *object,
+        const std::vector<PWP_UINT64> &addrs) const
+    {
+        FoamAddressFile file(object, fmt_);
+        setFileOptions(file);
+        if (!file.open(0, addrs.size())) {
+            return false;
         }
-        ...repeat...
-    */
+        for (size_t ii = 0; ii < addrs.size(); ++ii) {
+            file.writeAddress(addrs[ii]);
+        }
+        return file.close();
+    }
 
-    // write the boundary condition entries
-    void writeBoundaries(const BcStats &bcStats)
+    // write a labelList file with signed entries
+    bool writeSignedAddresses(const char *object,
+        const std::vector<PWP_INT64> &addrs) const
     {
-        BcStats::const_iterator it = bcStats.begin();
-        for (; it != bcStats.end(); ++it) {
-            fprintf(*this, "    %s\n", it->name_.c_str());
-            fprintf(*this, "    {\n");
-            fprintf(*this, "        type %s;\n", it->type_.c_str());
-            fprintf(*this, "        nFaces %lu;\n", (unsigned long)it->nFaces_);
-            fprintf(*this, "        startFace %lu;\n",
-                (unsigned long)it->startFace_);
-            fprintf(*this, "    }\n");
-            incrNumItems();
+        FoamAddressFile file(object, fmt_);
+        setFileOptions(file);
+        if (!file.open(0, addrs.size())) {
+            return false;
         }
+        for (size_t ii = 0; ii < addrs.size(); ++ii) {
+            file.writeSignedAddress(addrs[ii]);
+        }
+        return file.close();
     }
+
+private:
+    const PolyMesh                  &mesh_;         // the undecomposed mesh
+    const BcStats                   &patches_;      // the original patches
+    const std::vector<PWP_UINT32>   &cellProc_;     // subdomain of each cell
+    FoamFormat                      fmt_;           // output file format
+    PWP_UINT                        prec_;          // point precision
+    bool                            compactFaces_;  // true for faceCompactList
+    size_t                          bufSize_;       // file buffer size
+    bool                            compress_;      // true to gzip the files
+    std::vector<PWP_UINT64>         cellLocal_;     // subdomain cell index
+    std::vector<PWP_UINT64>         procCellStart_; // first of each bucket
+    std::vector<PWP_UINT64>         procCells_;     // cells by subdomain
+    std::vector<PWP_UINT64>         procFaceStart_; // first of each bucket
+    std::vector<PWP_UINT64>         procFaces_;     // faces by subdomain
 };
 
 
@@ -1086,7 +5173,8 @@ public:
 class VcSetFiles {
 public:
     // Default constructor
-    VcSetFiles(const PWGM_CONDDATA &vc, StringSet &usedNames) :
+    VcSetFiles(const PWGM_CONDDATA &vc, StringSet &usedNames,
+            const FoamFormat &fmt) :
         internalFaceSetFile_(0),
         boundaryFaceSetFile_(0),
         cellSetFile_(0)
@@ -1099,36 +5187,36 @@ public:
         // allocate sets per vc.tid
         if (VcIBFaces == (VcIBFaces & vc.tid)) {
             // interior and boundary faces go to different set files
-            internalFaceSetFile_ = new FoamFaceSetFile;
+            internalFaceSetFile_ = new FoamFaceSetFile(fmt);
             internalFaceSetFile_->open(uniqueSafeFileName(vc.name, usedNames,
                 sfxIFaces));
-            boundaryFaceSetFile_ = new FoamFaceSetFile;
+            boundaryFaceSetFile_ = new FoamFaceSetFile(fmt);
             boundaryFaceSetFile_->open(uniqueSafeFileName(vc.name, usedNames,
                 sfxBFaces));
         }
         else if (VcFaces == (VcFaces & vc.tid)) {
             // interior and boundary faces go to same set file
-            internalFaceSetFile_ = new FoamFaceSetFile;
+            internalFaceSetFile_ = new FoamFaceSetFile(fmt);
             internalFaceSetFile_->open(uniqueSafeFileName(vc.name, usedNames,
                 sfxFaces));
             boundaryFaceSetFile_ = internalFaceSetFile_;
         }
         else if (VcIFaces & vc.tid) {
             // interior face set only
-            internalFaceSetFile_ = new FoamFaceSetFile;
+            internalFaceSetFile_ = new FoamFaceSetFile(fmt);
             internalFaceSetFile_->open(uniqueSafeFileName(vc.name, usedNames,
                 sfxIFaces));
         }
         else if (VcBFaces & vc.tid) {
             // boundary face set only
-            boundaryFaceSetFile_ = new FoamFaceSetFile;
+            boundaryFaceSetFile_ = new FoamFaceSetFile(fmt);
             boundaryFaceSetFile_->open(uniqueSafeFileName(vc.name, usedNames,
                 sfxBFaces));
         }
 
         if (VcCells & vc.tid) {
             // build cell set
-            cellSetFile_ = new FoamCellSetFile;
+            cellSetFile_ = new FoamCellSetFile(fmt);
             cellSetFile_->open(uniqueSafeFileName(vc.name, usedNames,
                 "-cells"));
         }
@@ -1153,7 +5241,7 @@ public:
     }
 
     // write a boundary, connection or interior face
-    void addFace(PWGM_ENUM_FACETYPE type, PWP_UINT32 face)
+    void addFace(PWGM_ENUM_FACETYPE type, PWP_UINT64 face)
     {
         switch (type) {
         case PWGM_FACETYPE_BOUNDARY:
@@ -1220,9 +5308,7 @@ public:
     // delete set file with given name
     static void deleteSetFile(const char *name)
     {
-        std::string setFileName("sets/");
-        setFileName += name;
-        pwpFileDelete(setFileName.c_str());
+        pwpFileDelete(FoamSetFile::path(name).c_str());
     }
 
     // delete face set file(s)
@@ -1285,9 +5371,12 @@ public:
         rti_(*pRti),
         model_(model),
         writeInfo_(*pWriteInfo),
-        faces_(CAEPU_RT_DIM_2D(&rti_), PwModVertexCount(model_)),
-        owner_(),
-        neighbour_(),
+        format_(getFormat(model_, writeInfo_)),
+        meshBufSize_(WriteBufferSizeDef * 1024),
+        compressMesh_(false),
+        faces_(CAEPU_RT_DIM_2D(&rti_), PwModVertexCount(model_), format_),
+        owner_(format_),
+        neighbour_(format_),
         bcStats_(),
         usedFileNames_(),
         exportFaceSets_(false),
@@ -1297,6 +5386,8 @@ public:
         sideBcMode_(BcModeSingle),
         totElemCnt_(0),
         blkIdOffset_(),
+        cellRunFirst_(),
+        cellRunBlock_(),
         vcSetFiles_(),
         bcSetFiles_(),
         numFaces_(0),
@@ -1308,7 +5399,32 @@ public:
         doThicknessCalc_(false),
         thickness_(ThicknessDef),
         doFaceSets_(false),
-        setsDirWasCreated_(false)
+        setsDirWasCreated_(false),
+        collated_(false),
+        numSubdomains_(1),
+        decompMethod_(MeshPartitioner::Simple),
+        mesh_(),
+        pointPrec_(PointPrecisionDef),
+        renumberCells_(false),
+        sortPatchFaces_(false),
+        autoPrecision_(false),
+        faceCheckMode_(FaceCheckOff),
+        numFlipped_(0),
+        numUnsorted_(0),
+        prevLower_(0),
+        prevHigher_(0),
+        qualityMode_(QualityOff),
+        quality_(format_),
+        verts_(),
+        pointNew_(),
+        ordering_(),
+        pendingFaces_(),
+        patchGroup_(NoBcGroup),
+        patchFirst_(0),
+        patchCentroids_(),
+        domBcGroup_(),
+        bcGroupConds_(),
+        lastBcGroup_(NoBcGroup)
     {
         if (!PwModGetAttributeREAL(model_, Thickness, &thickness_)) {
             thickness_ = ThicknessDef;
@@ -1335,12 +5451,25 @@ public:
             PwModAppendEnumElementOrder(model_, PWGM_ELEMORDER_VC);
             bool isZPlanar;
             bool isConsistent;
-            GridValidator::getGridProperties(model_, isZPlanar, planeZ_,
-                orientation_, isConsistent);
+            GridValidator::Conflicts conflicts;
+            // the grid is validated from the cache if it fits
+            if (vertexCacheFits() && !verts_.load(model_)) {
+                caeuSendErrorMsg(&rti_, "Could not read the grid points.", 0);
+                return PWP_FALSE;
+            }
+            GridValidator::getGridProperties(model_, verts_, isZPlanar,
+                planeZ_, orientation_, isConsistent, conflicts);
             if (!isZPlanar) {
                 caeuSendErrorMsg(&rti_, "The grid is not Z-planar.", 0);
                 return PWP_FALSE;
             } else if (!isConsistent) {
+                for (size_t ii = 0; ii < conflicts.size(); ++ii) {
+                    std::ostringstream oss;
+                    oss << "Element " << conflicts[ii].element_ << " of block "
+                        << conflicts[ii].block_ << " is not oriented like "
+                        "element 0 of block 0.";
+                    caeuSendErrorMsg(&rti_, oss.str().c_str(), 0);
+                }
                 caeuSendErrorMsg(&rti_, "The grid has inconsistent normals.", 0);
                 return PWP_FALSE;
             }
@@ -1358,12 +5487,100 @@ public:
         exportFaceSets_  = (0 != (faceExport & 1));
         exportFaceZones_ = (0 != (faceExport & 2));
 
+        // faceList|faceCompactList
+        //        0|              1
+        PWP_UINT facesFormat = 0;
+        PwModGetAttributeUINT(model_, FacesFormat, &facesFormat);
+        faces_.setCompact(1 == facesFormat);
+
+        PWP_UINT writeBufferSize = WriteBufferSizeDef;
+        PwModGetAttributeUINT(model_, WriteBufferSize, &writeBufferSize);
+        meshBufSize_ = (size_t)writeBufferSize * 1024;
+
+        // None|Gzip
+        //    0|   1
+        PWP_UINT compression = 0;
+        PwModGetAttributeUINT(model_, Compression, &compression);
+        compressMesh_ = (1 == compression);
+        setMeshFileOptions(faces_);
+        setMeshFileOptions(owner_);
+        setMeshFileOptions(neighbour_);
+
+        // uncollated|collated
+        //          0|       1
+        PWP_UINT fileHandler = 0;
+        PwModGetAttributeUINT(model_, FileHandler, &fileHandler);
+        collated_ = (1 == fileHandler);
+
+        // Keep a copy of the mesh for decomposition
+        PwModGetAttributeUINT(model_, NumberOfSubdomains, &numSubdomains_);
+        if (1 < numSubdomains_) {
+            faces_.setCapture(&mesh_);
+            owner_.setCapture(&mesh_.owner_);
+            neighbour_.setCapture(&mesh_.neighbour_);
+        }
+        else if (collated_) {
+            caeuSendInfoMsg(&rti_, "The collated layout only applies to "
+                "processor meshes. The mesh is written uncollated.", 0);
+        }
+
+        // simple|rcb|morton|blocks
+        //      0|  1|     2|     3
+        PWP_UINT decompMethod = MeshPartitioner::Simple;
+        PwModGetAttributeUINT(model_, DecompositionMethod, &decompMethod);
+        decompMethod_ = static_cast<MeshPartitioner::Method>(decompMethod);
+
+        // Native|RCM
+        //      0|  1
+        PWP_UINT cellOrder = 0;
+        PwModGetAttributeUINT(model_, CellOrder, &cellOrder);
+        renumberCells_ = (1 == cellOrder);
+
+        // Native|Morton
+        //      0|     1
+        PWP_UINT patchFaceOrder = 0;
+        PwModGetAttributeUINT(model_, PatchFaceOrder, &patchFaceOrder);
+        sortPatchFaces_ = (1 == patchFaceOrder);
+
+        // Fixed|Auto
+        //     0|   1
+        PWP_UINT precMode = 0;
+        PwModGetAttributeUINT(model_, PointPrecisionMode, &precMode);
+        autoPrecision_ = (1 == precMode);
+
+        PWP_UINT faceOrderCheck = FaceCheckOff;
+        PwModGetAttributeUINT(model_, FaceOrderCheck, &faceOrderCheck);
+        faceCheckMode_ = static_cast<FaceCheckMode>(faceOrderCheck);
+
+        // Off|Report|ReportAndSets
+        //   0|     1|            2
+        PWP_UINT qualityCheck = QualityOff;
+        PwModGetAttributeUINT(model_, QualityCheck, &qualityCheck);
+        qualityMode_ = static_cast<QualityMode>(qualityCheck);
+        if (CAEPU_RT_DIM_2D(&rti_) && (QualityOff != qualityMode_)) {
+            caeuSendInfoMsg(&rti_, "The mesh quality is only checked for 3D "
+                "exports.", 0);
+            qualityMode_ = QualityOff;
+        }
+
+        // Native|FirstUse
+        //      0|       1
+        PWP_UINT pointOrder = 0;
+        PwModGetAttributeUINT(model_, PointOrder, &pointOrder);
+        if (1 == pointOrder) {
+            const PWP_UINT64 numPts = (PWP_UINT64)PwModVertexCount(model_) *
+                (CAEPU_RT_DIM_2D(&rti_) ? 2 : 1);
+            pointNew_.assign(numPts, FoamFacesFile::UnusedPoint);
+            faces_.setPointRenumbering(&pointNew_);
+        }
+
         PWP_UINT sideBCExport = BcModeSingle;
         PwModGetAttributeUINT(model_, SideBCExport, &sideBCExport);
         sideBcMode_ = static_cast<SideBcMode>(sideBCExport);
 
         PWP_BOOL ret = PWP_FALSE;
-        PWP_UINT32 majorSteps = 3 + (exportCellZones_ ? 1 : 0);
+        PWP_UINT32 majorSteps = 3 + (exportCellZones_ ? 1 : 0) +
+            ((1 < numSubdomains_) ? 1 : 0) + (needsOrdering() ? 1 : 0);
 
         if (!caeuProgressInit(&rti_, majorSteps)) {
         }
@@ -1373,6 +5590,16 @@ public:
         else if (needSetsDir() && !prepareVcSetFiles()) {
             caeuSendErrorMsg(&rti_, "Could prepare VC set files.", 0);
         }
+        else if ((QualitySets == qualityMode_) && !prepareQualitySetFiles()) {
+            caeuSendErrorMsg(&rti_, "Could not create mesh quality set files.",
+                0);
+        }
+        else if (!loadVertexCache()) {
+            caeuSendErrorMsg(&rti_, "Could not read the grid points.", 0);
+        }
+        else if (needsOrdering() && !processOrdering()) {
+            caeuSendErrorMsg(&rti_, "Could not renumber the mesh.", 0);
+        }
         else if (!processFaces()) {
             caeuSendErrorMsg(&rti_, "Could not write face files.", 0);
         }
@@ -1382,6 +5609,9 @@ public:
         else if (!processCells()) {
             caeuSendErrorMsg(&rti_, "Could not write cell sets.", 0);
         }
+        else if ((1 < numSubdomains_) && !processDecomposition()) {
+            caeuSendErrorMsg(&rti_, "Could not write processor meshes.", 0);
+        }
         else {
             ret = PWP_TRUE;
         }
@@ -1398,14 +5628,271 @@ public:
 
 private:
 
+    // Get the OpenFOAM case directory. The export destination must be the
+    // case's constant/polyMesh directory.
+    static bool getCaseDir(std::string &caseDir)
+    {
+        static const std::string PolyMeshDir("/constant/polyMesh");
+        std::string cwd;
+        if (!pwpGetCwd(cwd) || (cwd.size() <= PolyMeshDir.size()) ||
+                (0 != cwd.compare(cwd.size() - PolyMeshDir.size(),
+                    PolyMeshDir.size(), PolyMeshDir))) {
+            return false;
+        }
+        caseDir = cwd.substr(0, cwd.size() - PolyMeshDir.size());
+        return true;
+    }
+
+
+    // Create the root/constant/polyMesh directory tree
+    static bool createMeshDirs(const std::string &root)
+    {
+        const char * const Dirs[] = { "", "/constant", "/constant/polyMesh" };
+        const size_t numDirs = sizeof(Dirs) / sizeof(Dirs[0]);
+        for (size_t ii = 0; ii < numDirs; ++ii) {
+            if ((0 != pwpCreateDir((root + Dirs[ii]).c_str())) &&
+                    (EEXIST != errno)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+
+    // Partition the captured mesh, write the constant/cellDecomposition
+    // file and write each subdomain to <case>/processorN/constant/polyMesh,
+    // or to the <case>/processors<N> containers when collated
+    bool processDecomposition()
+    {
+        std::string caseDir;
+        if (!getCaseDir(caseDir)) {
+            caeuSendErrorMsg(&rti_, "Decomposed export requires a destination "
+                "of the form <case>/constant/polyMesh.", 0);
+            return false;
+        }
+        std::vector<PWP_UINT32> cellProc;
+        if (!partitionCells(cellProc)) {
+            caeuSendErrorMsg(&rti_, "Could not partition the cells.", 0);
+            return false;
+        }
+        if (!writeCellDecomposition(cellProc)) {
+            return false;
+        }
+        DecomposedCaseWriter writer(mesh_, bcStats_, cellProc, numSubdomains_,
+            format_, pointPrec_, faces_.isCompact(), meshBufSize_,
+            compressMesh_);
+
+        std::ostringstream oss;
+        oss << caseDir << "/processors" << numSubdomains_;
+        const std::string collatedRoot = oss.str();
+        bool ret = progressBeginStep(numSubdomains_) &&
+            (!collated_ || createMeshDirs(collatedRoot));
+        if (collated_) {
+            FoamFile::setCollatedRoot(collatedRoot);
+        }
+        for (PWP_UINT32 proc = 0; ret && (proc < numSubdomains_); ++proc) {
+            if (collated_) {
+                FoamFile::setCollatedBlock(proc);
+                ret = writer.write(proc);
+            }
+            else {
+                std::ostringstream dir;
+                dir << caseDir << "/processor" << proc;
+                const std::string meshDir = dir.str() + "/constant/polyMesh";
+                ret = createMeshDirs(dir.str()) &&
+                    (0 == pwpCwdPush(meshDir.c_str()));
+                if (ret) {
+                    ret = writer.write(proc);
+                    pwpCwdPop();
+                }
+            }
+            ret = ret && progressIncr();
+        }
+        if (collated_) {
+            FoamFile::setCollatedBlock(0);
+            FoamFile::setCollatedRoot(std::string());
+        }
+        progressEndStep();
+        return ret;
+    }
+
+
+    // Allocate the mesh copy kept for decomposition, or return false if it
+    // would exceed DecomposeMemorySize
+    bool reserveMeshCopy(PWP_UINT64 numFaces, PWP_UINT64 numInternal)
+    {
+        const PWP_UINT64 numPts = (PWP_UINT64)PwModVertexCount(model_) *
+            (CAEPU_RT_DIM_2D(&rti_) ? 2 : 1);
+        const PWP_UINT64 bytes = PolyMesh::bytesFor(numFaces, numInternal,
+            numPts);
+        PWP_UINT limit = DecomposeMemorySizeDef;
+        PwModGetAttributeUINT(model_, DecomposeMemorySize, &limit);
+        const PWP_UINT64 MiB = 1024 * 1024;
+        if (bytes > (PWP_UINT64)limit * MiB) {
+            std::ostringstream oss;
+            oss << "Decomposition needs a copy of the mesh of about " <<
+                (bytes + MiB - 1) / MiB << " MiB, more than the " << limit <<
+                " MiB DecomposeMemorySize.";
+            caeuSendErrorMsg(&rti_, oss.str().c_str(), 0);
+            return false;
+        }
+        mesh_.reserve(numFaces, numInternal, numPts);
+        return true;
+    }
+
+
+    // return true if the vertices are read more than once. 2D exports read
+    // them to validate the grid and to write both planes of points. The
+    // Auto point precision reads them to find the largest coordinate.
+    bool needsVertexCache() const
+    {
+        return CAEPU_RT_DIM_2D(&rti_) || sortPatchFaces_ || autoPrecision_ ||
+            (QualityOff != qualityMode_);
+    }
+
+
+    // return true if caching every vertex fits within VertexCacheSize
+    bool vertexCacheFits() const
+    {
+        PWP_UINT cacheSize = VertexCacheSizeDef;
+        PwModGetAttributeUINT(model_, VertexCacheSize, &cacheSize);
+        return VertexCache::bytesFor(PwModVertexCount(model_)) <=
+            (size_t)cacheSize * 1024 * 1024;
+    }
+
+
+    // Load the vertex cache if the vertices are read more than once and it
+    // fits within VertexCacheSize. Otherwise the cache is released and the
+    // vertices are read directly.
+    bool loadVertexCache()
+    {
+        const PWP_UINT32 numVerts = PwModVertexCount(model_);
+        const size_t MiB = 1024 * 1024;
+        if (!needsVertexCache()) {
+            verts_.release();
+            return true;
+        }
+        if (!vertexCacheFits()) {
+            PWP_UINT cacheSize = VertexCacheSizeDef;
+            PwModGetAttributeUINT(model_, VertexCacheSize, &cacheSize);
+            const size_t bytes = VertexCache::bytesFor(numVerts);
+            std::ostringstream oss;
+            oss << "Caching the points needs " << (bytes + MiB - 1) / MiB <<
+                " MiB, more than the " << cacheSize << " MiB VertexCacheSize. "
+                "The points are read directly.";
+            caeuSendInfoMsg(&rti_, oss.str().c_str(), 0);
+            return true;
+        }
+        if (!verts_.isLoaded() && !verts_.load(model_)) {
+            return false;
+        }
+        std::ostringstream oss;
+        oss << "Cached " << numVerts << " points in " <<
+            (verts_.bytes() + MiB - 1) / MiB << " MiB.";
+        caeuSendInfoMsg(&rti_, oss.str().c_str(), 0);
+        return true;
+    }
+
+
+    // assign each cell to a subdomain with the chosen method
+    bool partitionCells(std::vector<PWP_UINT32> &cellProc)
+    {
+        const bool isBlocks = (MeshPartitioner::Blocks == decompMethod_);
+        std::vector<float> centroids;
+        std::vector<unsigned char> weights;
+        std::vector<PWP_UINT32> cellBlock;
+        if (!getCellCentroids(centroids, weights, isBlocks ? &cellBlock : 0)) {
+            return false;
+        }
+        if (MeshPartitioner::Simple == decompMethod_) {
+            MeshPartitioner::partition(centroids, numSubdomains_, cellProc);
+        }
+        else if (isBlocks) {
+            MeshPartitioner::partitionBlocks(mesh_, centroids, weights,
+                cellBlock, numSubdomains_, cellProc);
+        }
+        else if (MeshPartitioner::Morton == decompMethod_) {
+            MeshPartitioner::partitionMorton(centroids, weights,
+                numSubdomains_, cellProc);
+        }
+        else {
+            MeshPartitioner::partitionRcb(centroids, weights, numSubdomains_,
+                cellProc);
+        }
+        return true;
+    }
+
+
+    // Get the centroid and weight of each cell from the captured mesh, and
+    // its block if cellBlock is not null. Centroids are the average of the
+    // cell's face centres, computed concurrently and stored as float x, y, z
+    // triples to halve their memory on very large grids. A cell's weight,
+    // its relative solver cost, is its number of faces, so 2D elements are
+    // weighted as the prisms and hexes they are extruded to.
+    bool getCellCentroids(std::vector<float> &centroids,
+        std::vector<unsigned char> &weights,
+        std::vector<PWP_UINT32> *cellBlock = 0)
+    {
+        const PWP_UINT32 numCells = PwModEnumElementCount(model_, 0);
+        mesh_.cellCentroids(centroids, weights);
+        if (weights.size() != numCells) {
+            return false;
+        }
+        if (0 == cellBlock) {
+            return true;
+        }
+        if (cellRunFirst_.empty() && !buildCellBlockIndex()) {
+            return false;
+        }
+        // store by exported cell index
+        cellBlock->resize(numCells);
+        for (size_t run = 0; run < cellRunFirst_.size(); ++run) {
+            const PWP_UINT32 last = (run + 1 < cellRunFirst_.size()) ?
+                cellRunFirst_[run + 1] : numCells;
+            for (PWP_UINT32 cell = cellRunFirst_[run]; cell < last; ++cell) {
+                (*cellBlock)[ordering_.cell(cell)] = cellRunBlock_[run];
+            }
+        }
+        return true;
+    }
+
+
+    // Write the constant/cellDecomposition file read by the decomposePar
+    // "manual" method
+    bool writeCellDecomposition(const std::vector<PWP_UINT32> &cellProc)
+    {
+        if (0 != pwpCwdPush("..")) {
+            return false;
+        }
+        FoamAddressFile file("cellDecomposition", format_, "constant");
+        bool ret = file.open(0, cellProc.size());
+        if (ret) {
+            for (size_t ii = 0; ii < cellProc.size(); ++ii) {
+                file.writeAddress(cellProc[ii]);
+            }
+            ret = closeFile(file);
+        }
+        pwpCwdPop();
+        return ret;
+    }
+
+
     // Accumulate boundary face group information. Data is written to
     // "boundary" file at end of export. This method assumes that the
     // faces are being streamed in boundary group order.
     void pushBcFace(const PWGM_FACESTREAM_DATA &data)
     {
-        PWGM_CONDDATA condData;
-        if (PwDomCondition(data.owner.domain, &condData)) {
-            pushBcFace(condData, data.face);
+        const PWP_UINT32 group = domainBcGroup(data.owner.domain);
+        if (NoBcGroup == group) {
+            // not in any BC group
+        }
+        else if (bcStats_.empty() || (group != lastBcGroup_)) {
+            pushBcFace(bcGroupConds_[group], data.face);
+            lastBcGroup_ = group;
+        }
+        else {
+            // same BC group, update face count
+            ++bcStats_.back().nFaces_;
         }
     }
 
@@ -1413,8 +5900,9 @@ private:
     // Accumulate boundary face group information. Data is written to
     // "boundary" file at end of export. This method assumes that the
     // faces are being streamed in boundary group order.
-    void pushBcFace(const PWGM_CONDDATA &condData, PWP_UINT32 faceId)
+    void pushBcFace(const PWGM_CONDDATA &condData, PWP_UINT64 faceId)
     {
+            lastBcGroup_ = NoBcGroup;
             if ((0 == bcStats_.size()) ||
                     (0 != bcStats_.back().name_.compare(condData.name))) {
                 // we are starting a new BC group
@@ -1432,6 +5920,97 @@ private:
         }
 
 
+    // Get the BC group of a domain, the index of its condition in
+    // bcGroupConds_. Domains with the same condition name share a group, so
+    // a group change is an integer compare. Each domain's condition is only
+    // read once.
+    PWP_UINT32 domainBcGroup(PWGM_HDOMAIN domain)
+    {
+        if (!PWGM_HDOMAIN_ISVALID(domain)) {
+            return NoBcGroup;
+        }
+        const PWP_UINT32 id = PWGM_HDOMAIN_ID(domain);
+        if (domBcGroup_.size() <= id) {
+            domBcGroup_.resize((size_t)id + 1, UnknownBcGroup);
+        }
+        PWP_UINT32 &group = domBcGroup_[id];
+        PWGM_CONDDATA condData;
+        if (UnknownBcGroup != group) {
+            // already known
+        }
+        else if (!PwDomCondition(domain, &condData)) {
+            group = NoBcGroup;
+        }
+        else {
+            group = 0;
+            while ((group < bcGroupConds_.size()) &&
+                    (0 != strcmp(bcGroupConds_[group].name, condData.name))) {
+                ++group;
+            }
+            if (bcGroupConds_.size() == group) {
+                bcGroupConds_.push_back(condData);
+            }
+        }
+        return group;
+    }
+
+
+    // Use the WriteBufferSize and Compression settings for a mesh file. Set
+    // and zone files keep the small default buffer.
+    void setMeshFileOptions(FoamFile &file) const
+    {
+        file.setBufferSize(meshBufSize_);
+        file.setCompression(compressMesh_);
+    }
+
+
+    // Build the mesh and set file format from the export settings
+    static FoamFormat getFormat(PWGM_HGRIDMODEL model,
+        const CAEP_WRITEINFO &writeInfo)
+    {
+        // 32|64
+        //  0| 1
+        PWP_UINT labelSize = 0;
+        PwModGetAttributeUINT(model, LabelSize, &labelSize);
+        return FoamFormat(PWP_FILETYPE_BINARY == writeInfo.fileType,
+            (1 == labelSize) ? 64 : 32,
+            (PWP_PRECISION_SINGLE == writeInfo.precision) ? 32 : 64);
+    }
+
+
+    // Close a file and report an incomplete file or an item count that does
+    // not match the count given to open()
+    bool closeFile(FoamFile &file)
+    {
+        const bool ret = file.close();
+        if (!ret) {
+            std::ostringstream oss;
+            oss << "Could not complete the '" << file.object() << "' file.";
+            if (file.countMismatch()) {
+                oss << " It has " << file.getNumItems() << " items but its "
+                    << "header declares " << file.getExpectedCount() << ".";
+            }
+            caeuSendErrorMsg(&rti_, oss.str().c_str(), 0);
+        }
+        return ret;
+    }
+
+
+    // Report a mesh that does not fit in the current label size
+    bool checkLabelOverflow(const FoamFile &file)
+    {
+        if (file.labelOverflow()) {
+            std::ostringstream oss;
+            oss << "The '" << file.object() << "' file exceeds the "
+                << format_.labelSize_ << "-bit label range. Set "
+                << LabelSize << " to 64.";
+            caeuSendErrorMsg(&rti_, oss.str().c_str(), 0);
+            return false;
+        }
+        return true;
+    }
+
+
     // Return whether the "sets" directory is needed during this export
     bool needSetsDir() const {
         return exportCellSets_ || exportCellZones_ || exportFaceSets_ ||
@@ -1467,37 +6046,155 @@ private:
         bool ret = false;
         const bool is2D = (0 != CAEPU_RT_DIM_2D(&rti_));
         const PWP_UINT32 numPts = PwModVertexCount(model_);
-        FoamPointFile points(prec);
+        if (autoPrecision_) {
+            prec = autoPointPrecision(prec);
+        }
+        pointPrec_ = prec;
+        FoamPointFile points(prec, format_);
+        setMeshFileOptions(points);
+        if (1 < numSubdomains_) {
+            points.setCapture(&mesh_);
+        }
         if (is2D && (UnknownZ == orientation_)) {
             // not good
         }
-        else if (progressBeginStep(numPts * (is2D ? 2 : 1)) && points.open()) {
+        else if (progressBeginStep(numPts * (is2D ? 2 : 1)) &&
+                points.open(0, (PWP_UINT64)numPts * (is2D ? 2 : 1))) {
             ret = true;
-            for (PWP_UINT32 ii = 0; ii < numPts; ++ii) {
-                points.writeVertex(PwModEnumVertices(model_, ii));
-                if (!progressIncr()) {
-                    ret = false;
-                    break;
+            if (!pointNew_.empty()) {
+                ret = writeRenumberedPoints(points);
+            }
+            else {
+                for (PWP_UINT32 ii = 0; ii < numPts; ++ii) {
+                    writeVertex(points, ii);
+                    if (!progressIncr()) {
+                        ret = false;
+                        break;
+                    }
                 }
             }
-            if (ret && is2D) {
+            if (ret && is2D && pointNew_.empty()) {
                 // Create a second set of points for a single cell thick
                 // extrusion. Thickened points are on the newZ plane.
                 const PWGM_XYZVAL newZ = planeZ_ + (orientation_ * thickness_);
                 for (PWP_UINT32 ii = 0; ii < numPts; ++ii) {
-                    points.writeVertex(PwModEnumVertices(model_, ii), newZ);
+                    writeVertex(points, ii, &newZ);
                     if (!progressIncr()) {
                         ret = false;
                         break;
                     }
                 }
             }
+            ret = closeFile(points) && ret && checkLabelOverflow(points);
         }
+        verts_.release();
         progressEndStep();
         return ret;
     }
 
 
+    // Write model vertex ii, from the vertex cache if it is loaded. The
+    // vertex is moved to the z plane newZ unless it is null.
+    void writeVertex(FoamPointFile &points, PWP_UINT32 ii,
+        const PWGM_XYZVAL *newZ = 0)
+    {
+        if (!verts_.isLoaded()) {
+            if (0 == newZ) {
+                points.writeVertex(PwModEnumVertices(model_, ii));
+            }
+            else {
+                points.writeVertex(PwModEnumVertices(model_, ii), *newZ);
+            }
+            return;
+        }
+        PWGM_VERTDATA v;
+        verts_.getVertex(ii, v);
+        if (0 != newZ) {
+            v.z = *newZ;
+        }
+        points.writeVertex(v);
+    }
+
+
+    // Write the points in order of their first use by the faces. Points not
+    // used by any face follow in their native order.
+    bool writeRenumberedPoints(FoamPointFile &points)
+    {
+        faces_.setPointRenumbering(0);
+        const PWP_UINT64 numPts = PwModVertexCount(model_);
+        PWP_UINT64 numUsed = faces_.getNumPointsUsed();
+        std::vector<PWP_UINT64> pointOld(pointNew_.size());
+        for (PWP_UINT64 ii = 0; ii < pointNew_.size(); ++ii) {
+            if (FoamFacesFile::UnusedPoint == pointNew_[ii]) {
+                pointNew_[ii] = numUsed++;
+            }
+            pointOld[pointNew_[ii]] = ii;
+        }
+        // 2D thickened points are on the newZ plane
+        const PWGM_XYZVAL newZ = planeZ_ + (orientation_ * thickness_);
+        for (PWP_UINT64 ii = 0; ii < pointOld.size(); ++ii) {
+            const PWP_UINT64 pt = pointOld[ii];
+            if (pt < numPts) {
+                writeVertex(points, (PWP_UINT32)pt);
+            }
+            else {
+                writeVertex(points, (PWP_UINT32)(pt - numPts), &newZ);
+            }
+            if (!progressIncr()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+
+    // Compute the fewest significant digits that keep every point within
+    // GridPointTol of its true location. Returns fixedPrec if the tolerance
+    // is not available.
+    PWP_UINT autoPointPrecision(PWP_UINT fixedPrec)
+    {
+        PWP_REAL gridPtTol = 0.0;
+        if (!PwModGetAttributeREAL(model_, "GridPointTol", &gridPtTol) ||
+                (gridPtTol <= 0.0)) {
+            return fixedPrec;
+        }
+        // The largest coordinate magnitude sits on a corner of the mesh
+        // bounding box.
+        PWGM_XYZVAL maxAbs = 0.0;
+        if (verts_.isLoaded()) {
+            maxAbs = verts_.maxAbs();
+        }
+        else {
+            // the cache exceeds VertexCacheSize, read the vertices directly
+            PWGM_VERTDATA vData;
+            PWP_UINT32 ndx = 0;
+            while (PwVertDataMod(PwModEnumVertices(model_, ndx++), &vData)) {
+                maxAbs = std::max(maxAbs, (PWGM_XYZVAL)fabs(vData.x));
+                maxAbs = std::max(maxAbs, (PWGM_XYZVAL)fabs(vData.y));
+                maxAbs = std::max(maxAbs, (PWGM_XYZVAL)fabs(vData.z));
+            }
+        }
+        if (0 != CAEPU_RT_DIM_2D(&rti_)) {
+            // include the thickened points' plane
+            const PWGM_XYZVAL newZ = planeZ_ + (orientation_ * thickness_);
+            maxAbs = std::max(maxAbs, (PWGM_XYZVAL)fabs(newZ));
+        }
+        // Rounding to N significant digits moves a value by at most
+        // 0.5 * 10^(1-N) * |value|.
+        PWP_UINT prec = PointPrecisionMin;
+        if (maxAbs > gridPtTol) {
+            const double digits = ceil(log10(maxAbs / gridPtTol)) + 1.0;
+            if (digits >= PointPrecisionMax) {
+                prec = PointPrecisionMax;
+            }
+            else if (digits > PointPrecisionMin) {
+                prec = (PWP_UINT)digits;
+            }
+        }
+        return prec;
+    }
+
+
     // Callback from plugin API when face streaming is about to begin
     static PWP_UINT32 streamBegin(PWGM_BEGINSTREAM_DATA *data)
     {
@@ -1509,10 +6206,27 @@ private:
         ofp.doFaceSets_ = ofp.faceSetsNeeded();
         ofp.totalEdgeLength_ = 0.0;
 
+        // 2D exports add the extruded base and top faces after streaming.
+        // They are all boundary faces.
+        PWP_UINT64 numFaces = data->totalNumFaces;
+        if (CAEPU_RT_DIM_2D(&ofp.rti_)) {
+            numFaces += 2 * (PWP_UINT64)PwModEnumElementCount(ofp.model_, 0);
+        }
+
         // Open the faces, owner, and neighbour export files. They are all
-        // written in parallel as faces stream into faceStreamCB().
+        // written in parallel as faces stream into faceStreamCB(). Their
+        // counts are known, so no file is revisited to patch its header.
+        // Interior and block connection faces both have a neighbour.
+        const PWP_UINT64 numNeighbours = (PWP_UINT64)data->numInteriorFaces +
+            data->numConnections;
+        if ((1 < ofp.numSubdomains_) &&
+                !ofp.reserveMeshCopy(numFaces, numNeighbours)) {
+            return PWP_FALSE;
+        }
         return ofp.progressBeginStep(data->totalNumFaces) &&
-               ofp.faces_.open() && ofp.owner_.open() && ofp.neighbour_.open();
+               ofp.faces_.openFaces(numFaces) &&
+               ofp.owner_.open(0, numFaces) &&
+               ofp.neighbour_.open(0, numNeighbours);
     }
 
 
@@ -1524,21 +6238,20 @@ private:
         }
         OpenFoamPlugin &ofp = *((OpenFoamPlugin*)data->userData);
 
-        // export the nth face's connectivity
-        ofp.faces_.writeFace(data->elemData);
+        // the nth face's index in the exported faces
+        const PWP_UINT64 face = ofp.ordering_.face(data->face);
 
-        // export the cell id that owns the nth face
-        ofp.owner_.writeAddress(data->owner.cellIndex);
+        // export the nth face's connectivity, the cell id that owns it and,
+        // unless on the boundary, the cell id on its other side
+        if (!ofp.writeFace(*data, face)) {
+            caeuSendErrorMsg(&ofp.rti_, "Could not reorder faces.", 0);
+            return 0;
+        }
 
         if (PWGM_FACETYPE_BOUNDARY == data->type) {
             // push face into boundary accumulator.
             ofp.pushBcFace(*data);
         }
-        else { // PWGM_FACETYPE_INTERIOR or PWGM_FACETYPE_CONNECTION
-            // export the cell id that is on the other side of the nth face
-            // (the owner's neighbour).
-            ofp.neighbour_.writeAddress(data->neighborCellIndex);
-        }
 
         if ((ofp.exportFaceSets_ || ofp.exportFaceZones_) &&
             (PWGM_FACETYPE_CONNECTION == data->type) &&
@@ -1557,7 +6270,8 @@ private:
             }
             else if (0 == pwpCwdPush("sets")) {
                 // "./sets" is now the cwd. Create new face set file for id
-                DomIdFaceSetFileMap::value_type val(id, FoamFaceSetFile());
+                DomIdFaceSetFileMap::value_type val(id,
+                    FoamFaceSetFile(ofp.format_));
                 PWGM_CONDDATA condData;
                 if (!PwDomCondition(data->owner.domain, &condData)) {
                     fsf = 0; // BAD
@@ -1576,7 +6290,7 @@ private:
             }
             if (0 != fsf) {
                 // add face to appropriate non-inflatable face set.
-                fsf->writeAddress(data->face);
+                fsf->writeAddress(face);
             }
             else {
                 caeuSendErrorMsg(&ofp.rti_, "Could not create faceSet.", 0);
@@ -1585,15 +6299,21 @@ private:
         }
 
         if (ofp.doFaceSets_) {
-            ofp.addFaceToSet(*data);
+            ofp.addFaceToSet(*data, face);
+        }
+
+        if ((QualityOff != ofp.qualityMode_) && !ofp.quality_.addFace(*data,
+                face, ofp.ordering_.cell(data->owner.cellIndex))) {
+            caeuSendErrorMsg(&ofp.rti_, "Could not measure the faces.", 0);
+            return 0;
         }
 
         if (ofp.doThicknessCalc_) {
             // Compute the edge's length and add it to the total.
             PWGM_XYZVAL xyz0[3];
             PWGM_XYZVAL xyz1[3];
-            if (getXYZ(xyz0, data->elemData.vert[0]) &&
-                    getXYZ(xyz1, data->elemData.vert[1])) {
+            if (ofp.verts_.getXYZ(xyz0, data->elemData, 0) &&
+                    ofp.verts_.getXYZ(xyz1, data->elemData, 1)) {
                 ofp.totalEdgeLength_ += calcLength(xyz0, xyz1);
             }
         }
@@ -1602,14 +6322,88 @@ private:
     }
 
 
-    void offsetVertices(PWP_UINT32 offset, PWGM_ELEMDATA &elemData)
+    // Write a streamed face, its owner and its neighbour, face is its
+    // exported index. Faces that stream ahead of their exported order are
+    // held until the faces before them are written.
+    bool writeFace(const PWGM_FACESTREAM_DATA &data, PWP_UINT64 face)
+    {
+        const bool isInternal = (PWGM_FACETYPE_BOUNDARY != data.type);
+        if (isInternal && (FaceCheckReport == faceCheckMode_) &&
+                !renumberCells_) {
+            checkFaceOrder(ordering_.cell(data.owner.cellIndex),
+                ordering_.cell(data.neighborCellIndex));
+        }
+        if (!ordering_.isReordered()) {
+            faces_.writeFace(data.elemData);
+            owner_.writeAddress(data.owner.cellIndex);
+            if (isInternal) {
+                neighbour_.writeAddress(data.neighborCellIndex);
+            }
+            return true;
+        }
+        FaceReorderBuffer::Face f;
+        f.cnt_ = faces_.faceIndices(data.elemData, f.ndx_);
+        f.owner_ = ordering_.cell(data.owner.cellIndex);
+        if (isInternal) {
+            f.neighbour_ = ordering_.cell(data.neighborCellIndex);
+            if (f.neighbour_ < f.owner_) {
+                // the normal must point to the higher numbered cell
+                std::swap(f.owner_, f.neighbour_);
+                f.flip();
+            }
+        }
+        if (!pendingFaces_.push(face, f)) {
+            return false;
+        }
+        while (pendingFaces_.pop(f)) {
+            if (0 != f.cnt_) {
+                faces_.writeFace(f.ndx_, f.cnt_);
+            }
+            owner_.writeAddress(f.owner_);
+            if (FaceReorderBuffer::NoNeighbour != f.neighbour_) {
+                neighbour_.writeAddress(f.neighbour_);
+            }
+        }
+        return true;
+    }
+
+
+    // Count an exported internal face that breaks OpenFOAM's upper
+    // triangular face order. The internal faces stream first, so each is
+    // compared with the one written before it.
+    void checkFaceOrder(PWP_UINT32 owner, PWP_UINT32 neighbour)
+    {
+        const PWP_UINT32 lower = std::min(owner, neighbour);
+        const PWP_UINT32 higher = std::max(owner, neighbour);
+        if (owner > neighbour) {
+            ++numFlipped_;
+        }
+        if ((lower < prevLower_) || ((lower == prevLower_) &&
+                (higher < prevHigher_))) {
+            ++numUnsorted_;
+        }
+        prevLower_ = lower;
+        prevHigher_ = higher;
+    }
+
+
+    // report the most faces held to write them in renumbered order
+    void reportPendingFaces()
+    {
+        const PWP_UINT64 MiB = 1024 * 1024;
+        std::ostringstream oss;
+        oss << "Held up to " << pendingFaces_.peak() << " of " << numFaces_ <<
+            " faces, " << (pendingFaces_.peakBytes() + MiB - 1) / MiB <<
+            " MiB, to write them in renumbered order.";
+        caeuSendInfoMsg(&rti_, oss.str().c_str(), 0);
+    }
+
+
+    // reverse the vertex order of an offset element
+    void flipVertices(PWGM_ELEMDATA &elemData)
     {
-        elemData.index[0] += offset;
-        elemData.index[1] += offset;
-        elemData.index[2] += offset;
         switch (elemData.type){
         case PWGM_ELEMTYPE_QUAD:
-            elemData.index[3] += offset;
             std::swap(elemData.index[0], elemData.index[3]);
             std::swap(elemData.index[1], elemData.index[2]);
             break;
@@ -1624,8 +6418,8 @@ private:
 
     void writeFaces()
     {
-        PWP_UINT32 faceOffset = numFaces_;
-        PWP_UINT32 vertOffset = 0;
+        PWP_UINT64 faceOffset = numFaces_;
+        PWP_UINT64 vertOffset = 0;
         // write original tri/quads as boundary elements of the extruded grid
         writeFaces(faceOffset, vertOffset);
         // write offset tri/quads as boundary elements of the extruded grid
@@ -1677,7 +6471,7 @@ private:
     }
 
 
-    void writeFaces(const PWP_UINT32 faceOffset, const PWP_UINT32 vertOffset)
+    void writeFaces(const PWP_UINT64 faceOffset, const PWP_UINT64 vertOffset)
     {
         const bool isOffset = (0 < vertOffset);
         PWGM_CONDDATA bc = { 0 };
@@ -1688,19 +6482,19 @@ private:
         while (PwElemDataModEnum(hElem, &eData)) {
             if (isOffset) {
                 // This element is an offset of an original element
-                offsetVertices(vertOffset, eData.elemData);
+                flipVertices(eData.elemData);
             }
-            // Add the face
-            faces_.writeFace(eData.elemData);
+            // Add the face, offset vertices are computed in 64 bits
+            faces_.writeFace(eData.elemData, vertOffset);
             // This 2D tri/quad element is extruded to a 3D element prism/hex
             // element with the same id as the 2D element. This cell id is the
             // face's owner.
-            owner_.writeAddress(PWGM_HELEMENT_ID(hElem));
+            owner_.writeAddress(ordering_.cell(PWGM_HELEMENT_ID(hElem)));
             // getElementCond() will update bc when blkId changes
             const PWP_UINT32 blkId = PWGM_HELEMENT_PID(eData.hBlkElement);
             getElementCond(blkId, bc, isOffset, prevBlkId);
             // The face id follows cell id with an offset
-            const PWP_UINT32 faceId = PWGM_HELEMENT_ID(hElem) + faceOffset;
+            const PWP_UINT64 faceId = PWGM_HELEMENT_ID(hElem) + faceOffset;
             pushBcFace(bc, faceId);
             if (doFaceSets_) {
                 // Add this boundary element (tri/quad) to the face set of the
@@ -1724,13 +6518,26 @@ private:
         for (; nit != ofp.nonInflBCSetFiles_.end(); ++nit) {
             nit->second.close();
         }
+        if (!ofp.pendingFaces_.empty()) {
+            caeuSendErrorMsg(&ofp.rti_, "Not all faces were exported.", 0);
+            return 0;
+        }
+        if (ofp.ordering_.isReordered()) {
+            ofp.reportPendingFaces();
+        }
+        if ((FaceCheckReport == ofp.faceCheckMode_) && !ofp.renumberCells_) {
+            ofp.reportFaceOrder();
+        }
         if (CAEPU_RT_DIM_2D(&ofp.rti_)) {
             ofp.writeFaces();
         }
         FoamBoundaryFile boundary;
-        if (boundary.open()) {
+        ofp.setMeshFileOptions(boundary);
+        bool ret = (0 != boundary.open(0, ofp.bcStats_.size()));
+        if (ret) {
             // Flush the accumulated BC information to the boundary file.
             boundary.writeBoundaries(ofp.bcStats_);
+            ret = ofp.closeFile(boundary);
         }
         if (ofp.doThicknessCalc_ && (0 < ofp.numFaces_)) {
             // Set thickness_ to the 2D grid's average edge length. Remember,
@@ -1742,7 +6549,7 @@ private:
             // Let user know!
             caeuSendInfoMsg(&ofp.rti_, oss.str().c_str(), 0);
         }
-        return ofp.progressEndStep();
+        return ofp.progressEndStep() && ret;
     }
 
 
@@ -1769,6 +6576,195 @@ private:
     }
 
 
+    // return true if the exported cell or face order must be computed
+    bool needsOrdering() const
+    {
+        return renumberCells_ || sortPatchFaces_ ||
+            (FaceCheckRepair == faceCheckMode_) || (QualityOff != qualityMode_);
+    }
+
+
+    // Compute the exported order of the cells and faces from a first face
+    // stream that writes nothing
+    bool processOrdering()
+    {
+        bool ret = (0 != PwModStreamFaces(model_, PWGM_FACEORDER_BCGROUPSLAST,
+            scanBegin, scanFace, scanEnd, (void *)this));
+        if (ret && sortPatchFaces_) {
+            sortPatch();
+        }
+        if (ret && renumberCells_) {
+            // the faces are sorted by the new cells
+            ordering_.renumberCells(PwModEnumElementCount(model_, 0));
+        }
+        else if (ret && (FaceCheckRepair == faceCheckMode_)) {
+            repairFaceOrder();
+        }
+        if (ret && (QualityOff != qualityMode_)) {
+            // the cells are measured by their exported index
+            quality_.endCells(ordering_);
+        }
+        return ret;
+    }
+
+
+    // create the bad face and cell set files of the mesh quality check
+    bool prepareQualitySetFiles()
+    {
+        bool ret = false;
+        if (createSetsDir() && (0 == pwpCwdPush("sets"))) {
+            ret = quality_.openSets(usedFileNames_);
+            pwpCwdPop();
+        }
+        return ret;
+    }
+
+
+    // report the mesh quality measures
+    void reportQuality()
+    {
+        StringVec msgs;
+        quality_.getReport(msgs);
+        for (size_t ii = 0; ii < msgs.size(); ++ii) {
+            caeuSendInfoMsg(&rti_, msgs[ii].c_str(), 0);
+        }
+    }
+
+
+    // Sort the scanned internal faces if any breaks OpenFOAM's upper
+    // triangular face order
+    void repairFaceOrder()
+    {
+        PWP_UINT64 numFlipped = 0;
+        PWP_UINT64 numUnsorted = 0;
+        ordering_.checkFaceOrder(numFlipped, numUnsorted);
+        if ((0 == numFlipped) && (0 == numUnsorted)) {
+            ordering_.clearInternalFaces();
+            return;
+        }
+        ordering_.sortFaces(PwModEnumElementCount(model_, 0));
+        std::ostringstream oss;
+        oss << numFlipped << " internal faces are owned by their higher cell "
+            "and " << numUnsorted << " are out of upper triangular order. "
+            "The faces were reordered.";
+        caeuSendInfoMsg(&rti_, oss.str().c_str(), 0);
+    }
+
+
+    // report the exported internal faces that break OpenFOAM's upper
+    // triangular face order
+    void reportFaceOrder()
+    {
+        if ((0 == numFlipped_) && (0 == numUnsorted_)) {
+            return;
+        }
+        std::ostringstream oss;
+        oss << numFlipped_ << " internal faces are owned by their higher cell "
+            "and " << numUnsorted_ << " are out of upper triangular order. "
+            "Set " << FaceOrderCheck << " to Repair to reorder them.";
+        caeuSendWarningMsg(&rti_, oss.str().c_str(), 0);
+    }
+
+
+    // Callback from plugin API when the ordering face stream is about to
+    // begin
+    static PWP_UINT32 scanBegin(PWGM_BEGINSTREAM_DATA *data)
+    {
+        if (0 == data->userData) {
+            return PWP_FALSE;
+        }
+        OpenFoamPlugin &ofp = *((OpenFoamPlugin*)data->userData);
+        if (QualityOff != ofp.qualityMode_) {
+            ofp.quality_.beginCells(PwModEnumElementCount(ofp.model_, 0),
+                ofp.verts_);
+        }
+        return ofp.progressBeginStep(data->totalNumFaces);
+    }
+
+
+    // Callback from plugin API to record a cell face for ordering
+    static PWP_UINT32 scanFace(PWGM_FACESTREAM_DATA *data)
+    {
+        if (0 == data->userData) {
+            return PWP_FALSE;
+        }
+        OpenFoamPlugin &ofp = *((OpenFoamPlugin*)data->userData);
+        if ((ofp.renumberCells_ || (FaceCheckRepair == ofp.faceCheckMode_)) &&
+                (PWGM_FACETYPE_BOUNDARY != data->type)) {
+            ofp.ordering_.addInternalFace(data->face, data->owner.cellIndex,
+                data->neighborCellIndex);
+        }
+        if (ofp.sortPatchFaces_ && (PWGM_FACETYPE_BOUNDARY == data->type) &&
+                !ofp.addPatchFace(*data)) {
+            return PWP_FALSE;
+        }
+        if ((QualityOff != ofp.qualityMode_) &&
+                !ofp.quality_.addCellFace(*data)) {
+            caeuSendErrorMsg(&ofp.rti_, "Could not measure the cells.", 0);
+            return PWP_FALSE;
+        }
+        return ofp.progressIncr();
+    }
+
+
+    // Record the centroid of a streamed boundary face. The faces of a patch
+    // stream together, so the previous patch is sorted as soon as a face of
+    // another patch arrives and only one patch is held at a time.
+    bool addPatchFace(const PWGM_FACESTREAM_DATA &data)
+    {
+        const PWP_UINT32 group = domainBcGroup(data.owner.domain);
+        if (NoBcGroup == group) {
+            // not in any patch, keep its streamed order
+            sortPatch();
+            return true;
+        }
+        if (!patchCentroids_.empty() && ((patchGroup_ != group) ||
+                (patchFirst_ + patchCentroids_.size() / 3 != data.face))) {
+            sortPatch();
+        }
+        if (patchCentroids_.empty()) {
+            patchGroup_ = group;
+            patchFirst_ = data.face;
+        }
+        const PWGM_ELEMDATA &elem = data.elemData;
+        PWGM_XYZVAL sum[3] = { 0.0, 0.0, 0.0 };
+        PWGM_XYZVAL xyz[3];
+        for (PWP_UINT32 ii = 0; ii < elem.vertCnt; ++ii) {
+            if (!verts_.getXYZ(xyz, elem, ii)) {
+                return false;
+            }
+            sum[0] += xyz[0];
+            sum[1] += xyz[1];
+            sum[2] += xyz[2];
+        }
+        const PWGM_XYZVAL n = (PWGM_XYZVAL)std::max(elem.vertCnt,
+            (PWP_UINT32)1);
+        for (int ii = 0; ii < 3; ++ii) {
+            patchCentroids_.push_back((float)(sum[ii] / n));
+        }
+        return true;
+    }
+
+
+    // sort the faces of the recorded patch and release its centroids
+    void sortPatch()
+    {
+        ordering_.sortPatch(patchFirst_, patchCentroids_);
+        std::vector<float>().swap(patchCentroids_);
+    }
+
+
+    // Callback from plugin API when the ordering face stream has completed
+    static PWP_UINT32 scanEnd(PWGM_ENDSTREAM_DATA *data)
+    {
+        if (0 == data->userData) {
+            return PWP_FALSE;
+        }
+        OpenFoamPlugin &ofp = *((OpenFoamPlugin*)data->userData);
+        return ofp.progressEndStep() && data->ok;
+    }
+
+
     // process the cell faces using the face streaming plugin API
     bool processFaces()
     {
@@ -1781,9 +6777,24 @@ private:
             streamEnd,                     // callback at end of streaming
             (void *)this));                // user data, passed to stream calls
 
+        // all faces are written, counts and labels can now be checked
+        ret = closeFile(faces_) && ret;
+        ret = closeFile(owner_) && ret;
+        ret = closeFile(neighbour_) && ret;
+        ret = ret && checkLabelOverflow(faces_) && checkLabelOverflow(owner_) &&
+            checkLabelOverflow(neighbour_);
+
         // write face sets accumulated during streaming
         finalizeFaceSets();
 
+        if (QualityOff != qualityMode_) {
+            quality_.endFaces();
+            if (QualitySets == qualityMode_) {
+                ret = quality_.closeSets() && ret;
+            }
+            reportQuality();
+        }
+
         // construct and write face zones
         if (ret && exportFaceZones_) {
             writeFaceZonesFile();
@@ -1860,15 +6871,14 @@ private:
                 // when block ID changes, switch current VC file
                 if (curBlkId != blkId) {
                     curBlkId = blkId;
-                    PWP_UINT32 offset = 0;
-                    if (blkIdOffset_.end() != blkIdOffset_.find(blkId)) {
-                        // blkId found in the offset map.
-                        offset = blkIdOffset_[blkId];
-                        vcFiles = vcSetFiles_.at(offset);
+                    if ((blkId < blkIdOffset_.size()) &&
+                            (NoVcOffset != blkIdOffset_[blkId])) {
+                        // blkId found in the offset table.
+                        vcFiles = vcSetFiles_.at(blkIdOffset_[blkId]);
                     }
                     else {
-                        // blkId NOT found in the offset map. It probably has
-                        // the Unspecified VC applied to it.
+                        // blkId NOT found in the offset table. It probably
+                        // has the Unspecified VC applied to it.
                         vcFiles = 0;
                     }
                     // If the block's vcFiles ptr was NOT found above or block
@@ -1885,7 +6895,7 @@ private:
 
                 // add the cell to the current VC file
                 if (vcFiles) {
-                    vcFiles->pushCell(cellId);
+                    vcFiles->pushCell(ordering_.cell(cellId));
                     if (!progressIncr()) {
                         ret = false;
                         break;
@@ -1904,7 +6914,7 @@ private:
     void writeCellZonesFile()
     {
         finalizeCellSets();
-        FoamCellZoneFile cellZones;
+        FoamCellZoneFile cellZones(format_);
         if (!progressBeginStep((PWP_UINT32)vcSetFiles_.size())) {
             // aborted
         }
@@ -1925,11 +6935,13 @@ private:
     bool prepareVcSetFiles()
     {
         // worst case scenario is numBlocks == numUniqueVCs
-        vcSetFiles_.reserve(PwModBlockCount(model_));
+        const PWP_UINT32 numBlocks = PwModBlockCount(model_);
+        vcSetFiles_.reserve(numBlocks);
+        blkIdOffset_.assign(numBlocks, NoVcOffset);
 
         // For each unique VC name:
         //  Create a VcSetFiles object.
-        //  Make a blkIdOffset_ mapping.
+        //  Make a blkIdOffset_ table entry.
         //  Keep a tally of the number of cells.
         //  Track the max index value.
         PWP_UINT32 blkId = 0;
@@ -1949,41 +6961,75 @@ private:
                 // first time for this VC name - allocate a new file
                 offset = (PWP_UINT32)vcSetFiles_.size();
                 vcNameOffset[vc.name] = offset;
-                VcSetFiles *vcset = new VcSetFiles(vc, usedFileNames_);
+                VcSetFiles *vcset = new VcSetFiles(vc, usedFileNames_,
+                    format_);
                 vcSetFiles_.push_back(vcset);
             }
             else {
                 // VC already mapped - use existing file
                 offset = iter->second;
             }
-            blkIdOffset_[blkId] = offset;
+            if (blkId < numBlocks) {
+                blkIdOffset_[blkId] = offset;
+            }
             totElemCnt_ += PwBlkElementCount(block, 0);
             block = PwModEnumBlocks(model_, ++blkId); // next block
         }
+        return buildCellBlockIndex();
+    }
+
+
+    // Index the block of each model cell. The cells of a block enumerate
+    // together, so only the first cell of each block is read and the run of
+    // cells it starts is recorded in cellRunFirst_ and cellRunBlock_.
+    bool buildCellBlockIndex()
+    {
+        cellRunFirst_.clear();
+        cellRunBlock_.clear();
+        const PWP_UINT32 numCells = PwModEnumElementCount(model_, 0);
+        PWGM_ENUMELEMDATA eData;
+        PWP_UINT32 cell = 0;
+        while (cell < numCells) {
+            if (!PwElemDataModEnum(PwModEnumElements(model_, cell), &eData)) {
+                return false;
+            }
+            const PWP_UINT32 blkId = PWGM_HELEMENT_PID(eData.hBlkElement);
+            const PWP_UINT32 numElems = PwBlkElementCount(
+                PwModEnumBlocks(model_, blkId), 0);
+            if (0 == numElems) {
+                return false;
+            }
+            cellRunFirst_.push_back(cell);
+            cellRunBlock_.push_back(blkId);
+            cell += numElems;
+        }
         return true;
     }
 
 
+    // get the block of a model cell from the cell block index
+    PWP_UINT32 cellBlock(PWP_UINT32 cell) const
+    {
+        const size_t run = std::upper_bound(cellRunFirst_.begin(),
+            cellRunFirst_.end(), cell) - cellRunFirst_.begin() - 1;
+        return cellRunBlock_[run];
+    }
+
+
     // Change face type from connection to interior when owner and neighbor
     // cells (which come from different blocks) but have the same volume
-    // condition. When VC block agglomeration is supported, this method won't
-    // be needed.
+    // condition. The blocks' VCs are compared by their vcSetFiles_ index.
+    // When VC block agglomeration is supported, this method won't be needed.
     PWGM_ENUM_FACETYPE adjustFaceType(const PWGM_FACESTREAM_DATA &data)
     {
         PWGM_ENUM_FACETYPE ret = data.type;
-        PWGM_ENUMELEMDATA eData;
-        if ((PWGM_FACETYPE_CONNECTION == ret) && PwElemDataModEnum(
-              PwModEnumElements(data.model, data.neighborCellIndex), &eData)) {
+        if (PWGM_FACETYPE_CONNECTION == ret) {
             // get blk id of neighbor cell
             PWP_UINT32 ownerBlkId = PWGM_HBLOCK_ID(data.owner.block);
-            PWP_UINT32 neighborBlkId = PWGM_HELEMENT_PID(eData.hBlkElement);
-            PWGM_CONDDATA vcOwner;
-            PWGM_CONDDATA vcNeighbor;
-            PWGM_HBLOCK blkOwner = PwModEnumBlocks(model_, ownerBlkId);
-            PWGM_HBLOCK blkNeighbor = PwModEnumBlocks(model_, neighborBlkId);
-            if (PwBlkCondition(blkOwner, &vcOwner) &&
-                    PwBlkCondition(blkNeighbor, &vcNeighbor) &&
-                    (vcOwner.name == vcNeighbor.name)) {
+            PWP_UINT32 neighborBlkId = cellBlock(data.neighborCellIndex);
+            const PWP_UINT32 vcOwner = blkIdOffset_[ownerBlkId];
+            if ((NoVcOffset != vcOwner) &&
+                    (vcOwner == blkIdOffset_[neighborBlkId])) {
                 ret = PWGM_FACETYPE_INTERIOR;
             }
         }
@@ -1991,34 +7037,31 @@ private:
     }
 
 
-    // store a cell face during face streaming
-    void addFaceToSet(const PWGM_FACESTREAM_DATA &data)
+    // store a cell face during face streaming, face is its exported index
+    void addFaceToSet(const PWGM_FACESTREAM_DATA &data, PWP_UINT64 face)
     {
         PWGM_ENUM_FACETYPE faceType = adjustFaceType(data);
-        addFaceToSet(PWGM_HBLOCK_ID(data.owner.block), faceType, data.face);
+        addFaceToSet(PWGM_HBLOCK_ID(data.owner.block), faceType, face);
         // A connection face has different VCs on either side.
         // Must also push face to neighbor's VcSetFiles
-        PWGM_ENUMELEMDATA eData;
-        if ((PWGM_FACETYPE_CONNECTION == faceType) && PwElemDataModEnum(
-              PwModEnumElements(data.model, data.neighborCellIndex), &eData)) {
-            PWP_UINT32 neighborBlkId = PWGM_HELEMENT_PID(eData.hBlkElement);
-            PWP_UINT32 neighborOffset = blkIdOffset_[neighborBlkId];
-            VcSetFiles *neighborVcFiles = vcSetFiles_.at(neighborOffset);
-            neighborVcFiles->addFace(faceType, data.face);
+        if (PWGM_FACETYPE_CONNECTION == faceType) {
+            PWP_UINT32 neighborBlkId = cellBlock(data.neighborCellIndex);
+            addFaceToSet(neighborBlkId, faceType, face);
         }
     }
 
 
     void addFaceToSet(const PWP_UINT32 blkId, PWGM_ENUM_FACETYPE faceType, 
-        PWP_UINT32 face)
+        PWP_UINT64 face)
     {
         PWP_UINT32 offset = blkIdOffset_[blkId];
-        VcSetFiles *vcFiles = vcSetFiles_.at(offset);
-        vcFiles->addFace(faceType, face);
+        if (NoVcOffset != offset) {
+            vcSetFiles_[offset]->addFace(faceType, face);
+        }
     }
 
 
-    void addBndryFaceToSet(const PWP_UINT32 blkId, PWP_UINT32 face)
+    void addBndryFaceToSet(const PWP_UINT32 blkId, PWP_UINT64 face)
     {
         addFaceToSet(blkId, PWGM_FACETYPE_BOUNDARY, face);
     }
@@ -2030,7 +7073,7 @@ private:
         finalizeFaceSets();
         const PWP_UINT32 stepCnt = (PWP_UINT32)(vcSetFiles_.size() +
             nonInflBCSetFiles_.size());
-        FoamFaceZoneFile faceZones;
+        FoamFaceZoneFile faceZones(format_);
         if (progressBeginStep(stepCnt) && faceZones.open()) {
             VcSetFilesVec::iterator it = vcSetFiles_.begin();
             for (; it != vcSetFiles_.end(); ++it) {
@@ -2120,9 +7163,16 @@ private:
 
 private:
 
+    static const PWP_UINT32 NoVcOffset = PWP_UINT32_MAX; // block without a VC
+    static const PWP_UINT32 NoBcGroup = PWP_UINT32_MAX; // domain without a BC
+    static const PWP_UINT32 UnknownBcGroup = PWP_UINT32_MAX - 1; // not read
+
     CAEP_RTITEM          &rti_;              // ref to runtimeWrite *pRti
     PWGM_HGRIDMODEL      model_;             // same as runtimeWrite model
     const CAEP_WRITEINFO &writeInfo_;        // ref to runtimeWrite *pWriteInfo
+    FoamFormat           format_;            // mesh and set file format
+    size_t               meshBufSize_;       // mesh file buffer size, bytes
+    bool                 compressMesh_;      // true to gzip the mesh files
     FoamFacesFile        faces_;             // The mesh "faces" file
     FoamOwnerFile        owner_;             // The mesh cell "owner" file
     FoamNeighbourFile    neighbour_;         // The mesh cell "neighbour" file
@@ -2133,11 +7183,13 @@ private:
     bool                 exportCellSets_;    // true if exporting cell sets
     bool                 exportCellZones_;   // true if exporting cell zones
     SideBcMode           sideBcMode_;        // side BC export setting
-    PWP_UINT32           totElemCnt_;        // total # of cells in all blocks
-    UInt32UInt32Map      blkIdOffset_;       // blkId to a vcSetFiles_ index
+    PWP_UINT64           totElemCnt_;        // total # of cells in all blocks
+    std::vector<PWP_UINT32> blkIdOffset_;    // blkId to a vcSetFiles_ index
+    std::vector<PWP_UINT32> cellRunFirst_;   // first cell of each block run
+    std::vector<PWP_UINT32> cellRunBlock_;   // blkId of each block run
     VcSetFilesVec        vcSetFiles_;        // vc file
     BcSetFileNames       bcSetFiles_;        // bc face set file names
-    PWP_UINT32           numFaces_;          // Number of faces for 2D export
+    PWP_UINT64           numFaces_;          // Number of faces for 2D export
     PWP_UINT32           curInflId_;         // current non-inflated dom id
     DomIdFaceSetFileMap  nonInflBCSetFiles_; // the non-inflated face set files
     Orientation          orientation_;       // 2D offset orientation
@@ -2147,8 +7199,37 @@ private:
     PWP_REAL             thickness_;         // The 2D extrusion thickness
     bool                 doFaceSets_;        // true if writing face sets
     bool                 setsDirWasCreated_; // set true if dir was created
+    bool                 collated_;          // true to collate processors
+    PWP_UINT             numSubdomains_;     // num processor meshes
+    MeshPartitioner::Method decompMethod_;   // how cells are partitioned
+    PolyMesh             mesh_;              // mesh copy for decomposition
+    PWP_UINT             pointPrec_;         // points file precision
+    bool                 renumberCells_;     // true if renumbering cells
+    bool                 sortPatchFaces_;    // true if sorting patch faces
+    bool                 autoPrecision_;     // true if PointPrecisionMode Auto
+    FaceCheckMode        faceCheckMode_;     // internal face order check
+    PWP_UINT64           numFlipped_;        // faces owned by higher cell
+    PWP_UINT64           numUnsorted_;       // faces out of triangular order
+    PWP_UINT32           prevLower_;         // lower cell of previous face
+    PWP_UINT32           prevHigher_;        // higher cell of previous face
+    QualityMode          qualityMode_;       // mesh quality check
+    MeshQuality          quality_;           // mesh quality measures
+    VertexCache          verts_;             // vertices until last used
+    std::vector<PWP_UINT64> pointNew_;       // new index of each point
+    MeshOrdering         ordering_;          // exported cell and face order
+    FaceReorderBuffer    pendingFaces_;      // faces not yet exported
+    PWP_UINT32           patchGroup_;        // BC group of the scanned patch
+    PWP_UINT64           patchFirst_;        // first face of scanned patch
+    std::vector<float>   patchCentroids_;    // face centroids of the patch
+    std::vector<PWP_UINT32> domBcGroup_;     // domain id to a BC group
+    std::vector<PWGM_CONDDATA> bcGroupConds_; // condition of each BC group
+    PWP_UINT32           lastBcGroup_;       // BC group of bcStats_.back()
 };
 
+const PWP_UINT32 OpenFoamPlugin::NoVcOffset;
+const PWP_UINT32 OpenFoamPlugin::NoBcGroup;
+const PWP_UINT32 OpenFoamPlugin::UnknownBcGroup;
+
 
 //***************************************************************************
 //***************************************************************************
@@ -2206,6 +7287,101 @@ runtimeCreate(CAEP_RTITEM * /* pRti */)
             PointPrecisionDefStr, "RW",
             "Controls the export of face sets and zones", "4 16");
 
+    // Let user derive the decimal precision from the grid point tolerance
+    ret = ret &&
+        caeuPublishValueDefinition(PointPrecisionMode, PWP_VALTYPE_ENUM,
+            "Fixed", "RW", "Controls how the point precision is chosen",
+            "Fixed|Auto");
+
+    // Let user control the label size
+    ret = ret &&
+        caeuPublishValueDefinition(LabelSize, PWP_VALTYPE_ENUM,
+            "32", "RW", "Controls the size of the mesh labels", "32|64");
+
+    // Let user control the faces file class
+    ret = ret &&
+        caeuPublishValueDefinition(FacesFormat, PWP_VALTYPE_ENUM,
+            "faceList", "RW", "Controls the class of the faces file",
+            "faceList|faceCompactList");
+
+    // Let user control the size of each file's output buffer
+    ret = ret &&
+        caeuPublishValueDefinition(WriteBufferSize, PWP_VALTYPE_UINT,
+            WriteBufferSizeDefStr, "RW",
+            "Size of each export file's output buffer in KiB", "64 1048576");
+
+    // Let user write the processor meshes in the OpenFOAM collated layout
+    ret = ret &&
+        caeuPublishValueDefinition(FileHandler, PWP_VALTYPE_ENUM,
+            "uncollated", "RW",
+            "Controls the OpenFOAM file layout of the processor meshes",
+            "uncollated|collated");
+
+    // Let user export a decomposed case
+    ret = ret &&
+        caeuPublishValueDefinition(NumberOfSubdomains, PWP_VALTYPE_UINT,
+            "1", "RW", "Number of processor meshes to write, 1 for none",
+            "1 65536");
+
+    // Let user choose how cells are assigned to the processor meshes
+    ret = ret &&
+        caeuPublishValueDefinition(DecompositionMethod, PWP_VALTYPE_ENUM,
+            "simple", "RW", "Controls how cells are assigned to processors. "
+            "simple cuts equal slabs along the longest axis only.",
+            "simple|rcb|morton|blocks");
+
+    // Let user renumber the cells to reduce the matrix bandwidth
+    ret = ret &&
+        caeuPublishValueDefinition(CellOrder, PWP_VALTYPE_ENUM,
+            "Native", "RW", "Controls the order of the exported cells",
+            "Native|RCM");
+
+    // Let user renumber the points by their first use in the faces
+    ret = ret &&
+        caeuPublishValueDefinition(PointOrder, PWP_VALTYPE_ENUM,
+            "Native", "RW", "Controls the order of the exported points",
+            "Native|FirstUse");
+
+    // Let user sort the faces of each boundary patch along a space-filling
+    // curve
+    ret = ret &&
+        caeuPublishValueDefinition(PatchFaceOrder, PWP_VALTYPE_ENUM,
+            "Native", "RW", "Controls the order of the faces in each patch",
+            "Native|Morton");
+
+    // Let user check and repair the upper triangular internal face order
+    ret = ret &&
+        caeuPublishValueDefinition(FaceOrderCheck, PWP_VALTYPE_ENUM,
+            "Off", "RW", "Controls the check of the internal face order",
+            "Off|Report|Repair");
+
+    // Let user measure the mesh quality and write the bad faces and cells
+    ret = ret &&
+        caeuPublishValueDefinition(QualityCheck, PWP_VALTYPE_ENUM,
+            "Off", "RW", "Controls the check of the mesh quality",
+            "Off|Report|ReportAndSets");
+
+    // Let user limit the memory used to cache the point coordinates
+    ret = ret &&
+        caeuPublishValueDefinition(VertexCacheSize, PWP_VALTYPE_UINT,
+            VertexCacheSizeDefStr, "RW",
+            "Largest point coordinate cache in MiB, 0 for none", "0 1048576");
+
+    // Let user limit the memory used to copy the mesh for decomposition
+    ret = ret &&
+        caeuPublishValueDefinition(DecomposeMemorySize, PWP_VALTYPE_UINT,
+            DecomposeMemorySizeDefStr, "RW",
+            "Largest mesh copy for decomposition in MiB, about 200 bytes "
+            "per cell", "1 1048576");
+
+#if defined(HAVE_ZLIB)
+    // Let user compress the points, faces, owner, neighbour and boundary files
+    ret = ret &&
+        caeuPublishValueDefinition(Compression, PWP_VALTYPE_ENUM,
+            "None", "RW", "Controls the compression of the mesh files",
+            "None|Gzip");
+#endif /* HAVE_ZLIB */
+
     // Let user control the 2D grid thickening offset
     ret = ret &&
         caeuPublishValueDefinition(Thickness, PWP_VALTYPE_REAL,